@@ -0,0 +1,348 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "graph.hpp"
+#include "csr_graph.hpp"
+#include "loader.hpp"
+#include "recommend.hpp"
+#include "recommend_cache.hpp"
+#include "cooccurrence_index.hpp"
+#include "live_graph.hpp"
+
+/*
+ * Recommendation benchmarks on a synthetic chart/track graph.  Track
+ * popularity is heavily skewed, so low track numbers are hubs with
+ * huge two-hop neighborhoods.  The graph is written out as an edge
+ * file first, to time loading it with populateGraph(), with the
+ * parallel loader and from a snapshot.  Finally a Zipf-distributed
+ * stream of requests is replayed with result caches of several sizes
+ * and with co-occurrence indexes, whose build and update times are
+ * reported too.  Last, the replay runs on several threads against a
+ * LiveGraph, with and without links being ingested meanwhile, and with
+ * an index listening to it.
+ *
+ * Usage: ab3-bench [charts] [tracks] [tracks per chart] [edge file]
+ */
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uint32_t nextRandom(uint64_t& state) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 33;
+}
+
+static std::string name(const char* prefix, size_t number) {
+    std::ostringstream ss;
+    ss << prefix << number;
+    return ss.str();
+}
+
+static void generate(const std::string& filename, size_t charts, size_t tracks, size_t perChart) {
+    std::ofstream output(filename.c_str());
+    uint64_t state = 42;
+    for (size_t c = 0; c < charts; c++) {
+        for (size_t i = 0; i < perChart; i++) {
+            double u = nextRandom(state) / 2147483648.0;
+            output << "chart-" << c << " => track-" << (size_t) (tracks * u * u * u) << "\n";
+        }
+    }
+}
+
+static void report(const char* method, size_t threads, size_t lines, double seconds) {
+    std::cout << "load\t" << method << "\t" << threads << "\t" << lines / seconds << "\t" << seconds << std::endl;
+}
+
+static void topK(CsrGraph* csr, size_t track) {
+    std::string trackId = name("track-", track);
+    size_t candidates = recommend(csr, trackId, (size_t) -1).size();
+    size_t limits[] = {1, 24, 100, 1000, (size_t) -1};
+    for (size_t l = 0; l < 5; l++) {
+        size_t reps = 0;
+        double start = now();
+        double elapsed;
+        do {
+            recommend(csr, trackId, limits[l]);
+            reps++;
+            elapsed = now() - start;
+        } while (elapsed < 0.2);
+
+        std::cout << "recommend\t" << trackId << "\t" << candidates << "\t";
+        if (limits[l] == (size_t) -1) {
+            std::cout << "all";
+        } else {
+            std::cout << limits[l];
+        }
+        std::cout << "\t" << elapsed / reps * 1e6 << std::endl;
+    }
+
+    const char* modeNames[] = {"shared", "normalized"};
+    ScoreMode modes[] = {SCORE_SHARED, SCORE_NORMALIZED};
+    for (size_t m = 0; m < 2; m++) {
+        size_t reps = 0;
+        double start = now();
+        double elapsed;
+        do {
+            recommend(csr, trackId, 24, modes[m]);
+            reps++;
+            elapsed = now() - start;
+        } while (elapsed < 0.2);
+        std::cout << modeNames[m] << "\t" << trackId << "\t" << candidates << "\t24\t" << elapsed / reps * 1e6 << std::endl;
+    }
+}
+
+// Replays requests for Zipf-distributed track numbers, so that track-0
+// is asked for most.  They go to the index first if there is one, then
+// through a cache of the given size or straight to recommend().
+static void replay(CsrGraph* csr, CooccurrenceIndex* index, size_t tracks, size_t requests, size_t megabytes) {
+    std::vector<double> cdf(tracks);
+    double total = 0;
+    for (size_t i = 0; i < tracks; i++) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+
+    RecommendCache* cache = megabytes ? new RecommendCache(megabytes << 20, 100, 16) : NULL;
+    std::vector<double> latencies(requests);
+    uint64_t state = 7;
+    for (size_t r = 0; r < requests; r++) {
+        double u = nextRandom(state) / 2147483648.0 * total;
+        std::string trackId = name("track-", std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        double start = now();
+        std::vector<std::pair<std::string, uint64_t> > scores;
+        if (index && index->lookup(trackId, 24, scores)) {
+        } else if (cache) {
+            cache->recommend(csr, trackId, 24);
+        } else {
+            recommend(csr, trackId, 24);
+        }
+        latencies[r] = (now() - start) * 1e6;
+    }
+
+    double sum = 0;
+    for (size_t r = 0; r < requests; r++) {
+        sum += latencies[r];
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "replay\t" << (index ? "index+" : "") << megabytes << "\t";
+    if (cache) {
+        RecommendCacheStats stats = cache->getStats();
+        std::cout << (double) stats.mHits / (stats.mHits + stats.mMisses) << "\t" << stats.mEvictions << "\t" << stats.mBytes / 1048576.0;
+    } else {
+        std::cout << "-\t-\t-";
+    }
+    std::cout << "\t" << sum / requests << "\t" << latencies[requests / 2] << "\t" << latencies[requests * 99 / 100] << std::endl;
+    delete cache;
+}
+
+/*
+ * A thread replaying requests against a LiveGraph until told to stop.
+ */
+struct Reader {
+    LiveGraph* mLive;
+    CooccurrenceIndex* mIndex;
+    RecommendCache* mCache;
+    const std::vector<double>* mCdf;
+    uint64_t mState;
+    bool* mStop;
+    std::vector<double> mLatencies;
+};
+
+static void* readThread(void* arg) {
+    Reader* reader = static_cast<Reader*>(arg);
+    const std::vector<double>& cdf = *reader->mCdf;
+    while (!__atomic_load_n(reader->mStop, __ATOMIC_ACQUIRE)) {
+        double u = nextRandom(reader->mState) / 2147483648.0 * cdf.back();
+        std::string trackId = name("track-", std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        double start = now();
+        SnapshotGuard guard(reader->mLive);
+        std::vector<std::pair<std::string, uint64_t> > scores;
+        if (!reader->mIndex || !reader->mIndex->lookup(trackId, 24, scores)) {
+            reader->mCache->recommend(guard.get(), trackId, 24);
+        }
+        reader->mLatencies.push_back((now() - start) * 1e6);
+    }
+    return NULL;
+}
+
+// Replays requests on four threads for a second while batches of links
+// to random charts are ingested, if there are any, and published every
+// 100 ms.  With a top N, requests go to an index of that size first,
+// which applies every published link.  Ingestion is timed on its own,
+// without the pauses between batches.
+static void ingest(CsrGraph* csr, size_t charts, size_t tracks, size_t batches, size_t indexTop) {
+    std::vector<double> cdf(tracks);
+    double total = 0;
+    for (size_t i = 0; i < tracks; i++) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+    std::vector<std::string> bodies(batches);
+    uint64_t state = 13;
+    for (size_t b = 0; b < batches; b++) {
+        std::ostringstream body;
+        for (size_t i = 0; i < 1000; i++) {
+            body << "chart-" << nextRandom(state) % (charts + charts / 10) << " => track-" << nextRandom(state) % (tracks + tracks / 10) << "\n";
+        }
+        bodies[b] = body.str();
+    }
+
+    LiveGraph live(csr);
+    RecommendCache cache(64 << 20, 100, 16);
+    CooccurrenceIndex* index = indexTop ? new CooccurrenceIndex(csr, "track-", indexTop, 4) : NULL;
+    live.addSnapshotListener(&cache);
+    if (index) {
+        live.addSnapshotListener(index);
+    }
+    live.start(100);
+    bool stop = false;
+    std::vector<Reader> readers(4);
+    std::vector<pthread_t> threads(readers.size());
+    for (size_t i = 0; i < readers.size(); i++) {
+        readers[i].mLive = &live;
+        readers[i].mIndex = index;
+        readers[i].mCache = &cache;
+        readers[i].mCdf = &cdf;
+        readers[i].mState = 7 + i;
+        readers[i].mStop = &stop;
+        pthread_create(&threads[i], NULL, readThread, &readers[i]);
+    }
+    double ingesting = 0;
+    size_t links = 0;
+    double start = now();
+    for (size_t b = 0; now() - start < 1.0; b++) {
+        if (b < batches) {
+            double batchStart = now();
+            links += live.addLinks(bodies[b].data(), bodies[b].size());
+            ingesting += now() - batchStart;
+        }
+        usleep(5000);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    std::vector<double> latencies;
+    for (size_t i = 0; i < readers.size(); i++) {
+        pthread_join(threads[i], NULL);
+        latencies.insert(latencies.end(), readers[i].mLatencies.begin(), readers[i].mLatencies.end());
+    }
+    live.stop();
+    delete index;
+
+    LiveGraphStats stats = live.getStats();
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << (indexTop ? "live index\t" : "live\t") << links << "\t";
+    if (links) {
+        std::cout << links / ingesting << "\t" << stats.mSnapshots << "\t";
+    } else {
+        std::cout << "-\t-\t";
+    }
+    if (stats.mSnapshots) {
+        std::cout << stats.mTotalPublishMicros / 1000.0 / stats.mSnapshots << "\t" << stats.mMaxPublishMicros / 1000.0 << "\t" << stats.mTotalListenerMicros / 1000.0 / stats.mSnapshots;
+    } else {
+        std::cout << "-\t-\t-";
+    }
+    std::cout << "\t" << latencies.size();
+    if (!latencies.empty()) {
+        std::cout << "\t" << latencies[latencies.size() / 2] << "\t" << latencies[latencies.size() * 99 / 100] << std::endl;
+    } else {
+        std::cout << "\t-\t-" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t charts = argc > 1 ? atoi(argv[1]) : 20000;
+    size_t tracks = argc > 2 ? atoi(argv[2]) : 200000;
+    size_t perChart = argc > 3 ? atoi(argv[3]) : 40;
+    std::vector<std::string> files(1, argc > 4 ? argv[4] : "/tmp/ab3-bench.edges");
+    size_t lines = charts * perChart;
+
+    double start = now();
+    generate(files[0], charts, tracks, perChart);
+    std::cout << "generate\t" << lines << " edges\t" << now() - start << " s" << std::endl;
+
+    std::cout << "op\tmethod\tthreads\tlines/s\tstartup s" << std::endl;
+    start = now();
+    Graph* graph = new Graph();
+    populateGraph(files[0], graph);
+    CsrGraph* csr = new CsrGraph(graph);
+    delete graph;
+    delete csr;
+    report("populate", 1, lines, now() - start);
+
+    size_t threads[] = {1, 4, 16, 64};
+    for (size_t t = 0; t < 4; t++) {
+        start = now();
+        csr = loadGraph(files, threads[t]);
+        report("mmap", threads[t], lines, now() - start);
+        if (t < 3) {
+            delete csr;
+        }
+    }
+    remove(files[0].c_str());
+
+    std::string snapshot = files[0] + ".snapshot";
+    start = now();
+    csr->save(snapshot);
+    std::cout << "save\t" << now() - start << " s" << std::endl;
+    delete csr;
+    start = now();
+    delete CsrGraph::load(snapshot, true);
+    report("verify", 1, lines, now() - start);
+    start = now();
+    csr = CsrGraph::load(snapshot, false);
+    report("snapshot", 1, lines, now() - start);
+    remove(snapshot.c_str());
+    std::cout << "graph\t" << csr->size() << " nodes" << std::endl;
+
+    std::cout << "op\ttrack\tcandidates\tlimit\tus/request" << std::endl;
+    size_t samples[] = {0, 10, 100, 1000, 10000};
+    for (size_t s = 0; s < 5; s++) {
+        topK(csr, samples[s] * tracks / 200000);
+    }
+
+    std::cout << "op\tcache MB\thit rate\tevictions\tused MB\tmean us\tp50 us\tp99 us" << std::endl;
+    size_t megabytes[] = {0, 1, 16, 64};
+    for (size_t m = 0; m < 4; m++) {
+        replay(csr, NULL, tracks, 10000, megabytes[m]);
+    }
+
+    size_t topN[] = {24, 100};
+    for (size_t n = 0; n < 2; n++) {
+        start = now();
+        CooccurrenceIndex* index = new CooccurrenceIndex(csr, "track-", topN[n], 4);
+        std::cout << "index\ttop " << topN[n] << "\t" << index->getBytes() / 1048576.0 << " MB\t" << now() - start << " s" << std::endl;
+        replay(csr, index, tracks, 10000, 0);
+
+        uint64_t state = 11;
+        size_t links = 0;
+        start = now();
+        for (size_t i = 0; i < 1000; i++) {
+            uint32_t chart;
+            uint32_t track;
+            if (csr->findId(name("chart-", nextRandom(state) % charts), chart) && csr->findId(name("track-", nextRandom(state) % tracks), track)) {
+                index->addLink(chart, track, 1);
+                links++;
+            }
+        }
+        std::cout << "index\tupdate\t" << (now() - start) / links * 1e6 << " us/link" << std::endl;
+        delete index;
+    }
+
+    std::cout << "op\tlinks\tlinks/s\tsnapshots\tpublish mean ms\tpublish max ms\tlisteners mean ms\treads\tp50 us\tp99 us" << std::endl;
+    ingest(csr, charts, tracks, 0, 0);
+    ingest(csr, charts, tracks, 100, 0);
+    ingest(csr, charts, tracks, 100, 24);
+
+    delete csr;
+    return 0;
+}
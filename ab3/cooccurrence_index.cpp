@@ -0,0 +1,518 @@
+#include <iostream>
+#include <algorithm>
+#include "cooccurrence_index.hpp"
+#include "recommend.hpp"
+#include "utils.hpp"
+
+namespace {
+
+const uint32_t buildBlock = 256;
+
+// Sum over the common neighbors of two sorted, unique adjacency lists
+// of the products of their weights.
+uint64_t productIntersection(const std::vector<std::pair<uint32_t, uint32_t> >& a, const std::vector<std::pair<uint32_t, uint32_t> >& b) {
+    uint64_t total = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i].first < b[j].first) {
+            i++;
+        } else if (b[j].first < a[i].first) {
+            j++;
+        } else {
+            total += (uint64_t) a[i++].second * b[j++].second;
+        }
+    }
+    return total;
+}
+
+}
+
+// Builds the lists of all nodes in the prefix range, with the given
+// number of threads taking blocks of nodes in turn.
+CooccurrenceIndex::CooccurrenceIndex(CsrGraph* graph, const std::string& prefix, size_t topN, unsigned int threads) : mTopN(topN), mLists(new Lists), mApplied(0), mUnindexed(0), mPrefix(prefix), mLive(NULL), mRebuildGraph(NULL), mNextGraph(NULL), mRebuilding(false), mRebuilderStarted(false), mRebuilds(0) {
+    pthread_mutex_init(&mLock, NULL);
+
+    uint32_t low = 0;
+    uint32_t high = graph->size();
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (graph->getName(middle).compare(0, prefix.size(), prefix) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    mLists->mFirst = low;
+    high = graph->size();
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (graph->getName(middle).compare(0, prefix.size(), prefix) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    mLists->mLast = low;
+
+    uint32_t count = mLists->mLast - mLists->mFirst;
+    mLists->mGraph = graph;
+    mLists->mRetainedGraph = NULL;
+    mLists->mSizes.assign(count, 0);
+    mLists->mIds.resize(count * mTopN);
+    mLists->mScores.resize(count * mTopN);
+    mLists->mChanged.assign(count, NULL);
+    mNextBlock = mLists->mFirst;
+    std::vector<pthread_t> workers(threads ? threads : 1);
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i], NULL, buildThread, this);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+CooccurrenceIndex::~CooccurrenceIndex() {
+    if (mRebuilderStarted) {
+        pthread_join(mRebuilder, NULL);
+    }
+    for (size_t i = 0; i < mRetired.size(); i++) {
+        delete mRetired[i];
+    }
+    deleteLists(mLists);
+    if (mNextGraph) {
+        mLive->release(mNextGraph);
+    }
+    pthread_mutex_destroy(&mLock);
+}
+
+void CooccurrenceIndex::deleteLists(Lists* lists) {
+    for (size_t i = 0; i < lists->mChanged.size(); i++) {
+        delete lists->mChanged[i];
+    }
+    if (lists->mRetainedGraph) {
+        mLive->release(lists->mRetainedGraph);
+    }
+    delete lists;
+}
+
+void* CooccurrenceIndex::buildThread(void* arg) {
+    CooccurrenceIndex* index = static_cast<CooccurrenceIndex*>(arg);
+    Lists* lists = index->mLists;
+    ScoreCounter counter;
+    counter.resize(lists->mGraph->size());
+    std::vector<std::pair<uint32_t, uint64_t> > scores;
+    uint32_t block;
+    while ((block = __sync_fetch_and_add(&index->mNextBlock, buildBlock)) < lists->mLast) {
+        for (uint32_t node = block; node < lists->mLast && node < block + buildBlock; node++) {
+            index->rank(node, counter, scores);
+            size_t base = (node - lists->mFirst) * index->mTopN;
+            for (size_t i = 0; i < scores.size(); i++) {
+                lists->mIds[base + i] = scores[i].first;
+                lists->mScores[base + i] = scores[i].second;
+            }
+            lists->mSizes[node - lists->mFirst] = scores.size();
+        }
+    }
+    return NULL;
+}
+
+// Builds a new index on the compacted graph with one thread, so that
+// serving keeps the other cores, then replays the links that came in
+// meanwhile until none are left and swaps in the new lists.  The old
+// ones go once no lookup can still be reading them.  Goes on with the
+// last compaction since, if any.
+void* CooccurrenceIndex::rebuildThread(void* arg) {
+    CooccurrenceIndex* index = static_cast<CooccurrenceIndex*>(arg);
+    CsrGraph* graph = index->mRebuildGraph;
+    std::vector<CsrLink> links;
+    while (graph) {
+        CooccurrenceIndex* fresh = new CooccurrenceIndex(graph, index->mPrefix, index->mTopN, 1);
+        fresh->mLists->mRetainedGraph = graph;
+        while (true) {
+            pthread_mutex_lock(&index->mLock);
+            links.clear();
+            links.swap(index->mReplay);
+            if (links.empty()) {
+                fresh->mLive = index->mLive;
+                Lists* old = index->mLists;
+                __atomic_store_n(&index->mLists, fresh->mLists, __ATOMIC_SEQ_CST);
+                fresh->mLists = old;
+                index->mRebuilds++;
+                graph = index->mNextGraph;
+                index->mNextGraph = NULL;
+                index->mReplay.swap(index->mNextReplay);
+                index->mNextReplay.clear();
+                index->mRebuilding = graph != NULL;
+                pthread_mutex_unlock(&index->mLock);
+                break;
+            }
+            pthread_mutex_unlock(&index->mLock);
+            for (size_t i = 0; i < links.size(); i++) {
+                fresh->apply(links[i].mOne, links[i].mTwo, links[i].mWeight);
+            }
+        }
+        index->mReaders.synchronize(index->mReaders.advance());
+        delete fresh;
+    }
+    return NULL;
+}
+
+// The sorted, unique neighbors of the node and their weights, from the
+// CsrGraph plus the links added since.
+void CooccurrenceIndex::neighbors(uint32_t node, std::vector<std::pair<uint32_t, uint32_t> >& list) {
+    CsrGraph* graph = mLists->mGraph;
+    const uint32_t* csr = graph->getNeighbors(node);
+    const uint32_t* weights = graph->getWeights(node);
+    uint64_t degree = graph->getDegree(node);
+    list.clear();
+    for (uint64_t i = 0; i < degree; i++) {
+        list.push_back(std::make_pair(csr[i], weights[i]));
+    }
+    std::map<uint32_t, std::vector<std::pair<uint32_t, uint32_t> > >::iterator added = mLists->mAdded.find(node);
+    if (added == mLists->mAdded.end()) {
+        return;
+    }
+
+    list.insert(list.end(), added->second.begin(), added->second.end());
+    std::sort(list.begin(), list.end());
+    size_t unique = 0;
+    for (size_t i = 0; i < list.size(); i++) {
+        if (unique > 0 && list[i].first == list[unique - 1].first) {
+            list[unique - 1].second = add_weight(list[unique - 1].second, list[i].second);
+        } else {
+            list[unique++] = list[i];
+        }
+    }
+    list.resize(unique);
+}
+
+// Recomputes the whole list of the node the way recommend() does, with
+// the counter as scratch space.
+void CooccurrenceIndex::rank(uint32_t node, ScoreCounter& counter, std::vector<std::pair<uint32_t, uint64_t> >& scores) {
+    std::vector<std::pair<uint32_t, uint32_t> > charts;
+    std::vector<std::pair<uint32_t, uint32_t> > tracks;
+    neighbors(node, charts);
+    for (size_t i = 0; i < charts.size(); i++) {
+        neighbors(charts[i].first, tracks);
+        for (size_t j = 0; j < tracks.size(); j++) {
+            uint32_t track = tracks[j].first;
+            if (track == node) {
+                continue;
+            }
+            counter.add(track, (uint64_t) charts[i].second * tracks[j].second);
+        }
+    }
+
+    scores.clear();
+    counter.drain(scores);
+    if (scores.size() > mTopN) {
+        std::nth_element(scores.begin(), scores.begin() + mTopN, scores.end(), sortIdPairs);
+        scores.resize(mTopN);
+    }
+    std::sort(scores.begin(), scores.end(), sortIdPairs);
+}
+
+// The score of other in the recommendations of node, from the charts
+// they share.
+uint64_t CooccurrenceIndex::pairScore(uint32_t node, uint32_t other) {
+    std::vector<std::pair<uint32_t, uint32_t> > a;
+    std::vector<std::pair<uint32_t, uint32_t> > b;
+    neighbors(node, a);
+    neighbors(other, b);
+    return productIntersection(a, b);
+}
+
+// Copies the current list of a node in the prefix range, and returns
+// whether it is stale.
+bool CooccurrenceIndex::current(uint32_t node, std::vector<std::pair<uint32_t, uint64_t> >& entries) {
+    List* list = mLists->mChanged[node - mLists->mFirst];
+    if (list) {
+        entries = list->mEntries;
+        return list->mStale;
+    }
+    size_t base = (node - mLists->mFirst) * mTopN;
+    entries.clear();
+    for (size_t i = 0; i < mLists->mSizes[node - mLists->mFirst]; i++) {
+        entries.push_back(std::make_pair(mLists->mIds[base + i], mLists->mScores[base + i]));
+    }
+    return false;
+}
+
+// Swaps in a new list for the node, taking over the entries, and keeps
+// the one it replaces until reclaim().
+void CooccurrenceIndex::replace(uint32_t node, std::vector<std::pair<uint32_t, uint64_t> >& entries, bool stale) {
+    List* list = new List;
+    list->mStale = stale;
+    list->mEntries.swap(entries);
+    List* old = mLists->mChanged[node - mLists->mFirst];
+    __atomic_store_n(&mLists->mChanged[node - mLists->mFirst], list, __ATOMIC_SEQ_CST);
+    if (old) {
+        mRetired.push_back(old);
+    }
+}
+
+void CooccurrenceIndex::markStale(uint32_t node) {
+    if (node < mLists->mFirst || node >= mLists->mLast) {
+        return;
+    }
+    std::vector<std::pair<uint32_t, uint64_t> > entries;
+    if (!current(node, entries)) {
+        replace(node, entries, true);
+    }
+}
+
+// Moves other up the list of node after its score went up, or lets it
+// in if it now beats the last entry of a full list.
+void CooccurrenceIndex::raise(uint32_t node, uint32_t other) {
+    if (node < mLists->mFirst || node >= mLists->mLast || node == other || mTopN == 0) {
+        return;
+    }
+    std::pair<uint32_t, uint64_t> entry(other, pairScore(node, other));
+    std::vector<std::pair<uint32_t, uint64_t> > entries;
+    bool stale = current(node, entries);
+    size_t position = 0;
+    while (position < entries.size() && entries[position].first != other) {
+        position++;
+    }
+    if (position == entries.size() && entries.size() == mTopN) {
+        position--;
+        if (!sortIdPairs(entry, entries[position])) {
+            return;
+        }
+    } else if (position == entries.size()) {
+        entries.push_back(entry);
+    }
+
+    while (position > 0 && sortIdPairs(entry, entries[position - 1])) {
+        entries[position] = entries[position - 1];
+        position--;
+    }
+    entries[position] = entry;
+    replace(node, entries, stale);
+}
+
+// Answers from the list of the track if it holds enough entries and is
+// not stale.
+bool CooccurrenceIndex::lookup(const std::string& track, size_t limit, std::vector<std::pair<std::string, uint64_t> >& scoreList) {
+    unsigned int slot = mReaders.enter();
+    Lists* lists = __atomic_load_n(&mLists, __ATOMIC_SEQ_CST);
+    uint32_t node;
+    if (!lists->mGraph->findId(track, node) || node < lists->mFirst || node >= lists->mLast) {
+        mReaders.leave(slot);
+        return false;
+    }
+    List* list = __atomic_load_n(&lists->mChanged[node - lists->mFirst], __ATOMIC_SEQ_CST);
+    size_t size = list ? list->mEntries.size() : lists->mSizes[node - lists->mFirst];
+    if ((limit > size && size == mTopN) || (list && list->mStale)) {
+        mReaders.leave(slot);
+        return false;
+    }
+    size_t base = (node - lists->mFirst) * mTopN;
+    for (size_t i = 0; i < size && i < limit; i++) {
+        if (list) {
+            scoreList.push_back(std::make_pair(lists->mGraph->getName(list->mEntries[i].first), list->mEntries[i].second));
+        } else {
+            scoreList.push_back(std::make_pair(lists->mGraph->getName(lists->mIds[base + i]), lists->mScores[base + i]));
+        }
+    }
+    mReaders.leave(slot);
+    return true;
+}
+
+// Deletes the lists replaced so far, once no lookup can still be
+// reading them.  Called without the lock, so that writers do not wait
+// for readers.
+void CooccurrenceIndex::reclaim() {
+    std::vector<List*> retired;
+    pthread_mutex_lock(&mLock);
+    retired.swap(mRetired);
+    pthread_mutex_unlock(&mLock);
+    if (retired.empty()) {
+        return;
+    }
+    mReaders.synchronize(mReaders.advance());
+    for (size_t i = 0; i < retired.size(); i++) {
+        delete retired[i];
+    }
+}
+
+// A link between one and two changes the score of two for the nodes
+// next to one and the other way round, besides the lists of one and
+// two themselves.
+void CooccurrenceIndex::addLink(uint32_t one, uint32_t two, uint32_t weight) {
+    pthread_mutex_lock(&mLock);
+    addLinkLocked(one, two, weight);
+    pthread_mutex_unlock(&mLock);
+    reclaim();
+}
+
+void CooccurrenceIndex::addLinkLocked(uint32_t one, uint32_t two, uint32_t weight) {
+    if (!mLists->mUnknownNeighbors.empty()) {
+        if (mLists->mUnknownNeighbors[two]) {
+            markStale(one);
+        }
+        if (mLists->mUnknownNeighbors[one]) {
+            markStale(two);
+        }
+    }
+    mLists->mAdded[one].push_back(std::make_pair(two, weight));
+    mLists->mAdded[two].push_back(std::make_pair(one, weight));
+    mCounter.resize(mLists->mGraph->size());
+
+    uint32_t ends[] = {one, two};
+    std::vector<std::pair<uint32_t, uint32_t> > around;
+    std::vector<std::pair<uint32_t, uint64_t> > scores;
+    for (size_t i = 0; i < 2; i++) {
+        if (ends[i] >= mLists->mFirst && ends[i] < mLists->mLast) {
+            List* list = mLists->mChanged[ends[i] - mLists->mFirst];
+            rank(ends[i], mCounter, scores);
+            replace(ends[i], scores, list && list->mStale);
+        }
+        neighbors(ends[i], around);
+        for (size_t j = 0; j < around.size(); j++) {
+            if (around[j].first != one && around[j].first != two) {
+                raise(around[j].first, ends[1 - i]);
+            }
+        }
+    }
+    mApplied++;
+}
+
+// A link from a known node to an unknown one changes the list of the
+// known node and of its neighbors, which gain the unknown one.  Lists
+// of the unknown node's other neighbors gain the known node; they were
+// marked when their own links to it came in.  Later links to the known
+// node bring the unknown one into the lists of their other end, which
+// addLink() marks.  Also keeps the link for the rebuilds to come, if
+// any.
+void CooccurrenceIndex::applyLocked(const std::string& one, const std::string& two, uint32_t weight) {
+    if (mRebuilding) {
+        CsrLink link;
+        link.mOne = one;
+        link.mTwo = two;
+        link.mWeight = weight;
+        mReplay.push_back(link);
+        if (mNextGraph) {
+            mNextReplay.push_back(link);
+        }
+    }
+
+    uint32_t idOne;
+    uint32_t idTwo;
+    bool knownOne = mLists->mGraph->findId(one, idOne);
+    bool knownTwo = mLists->mGraph->findId(two, idTwo);
+    if (knownOne && knownTwo) {
+        addLinkLocked(idOne, idTwo, weight);
+        return;
+    }
+
+    mUnindexed++;
+    if (knownOne || knownTwo) {
+        uint32_t known = knownOne ? idOne : idTwo;
+        if (mLists->mUnknownNeighbors.empty()) {
+            mLists->mUnknownNeighbors.resize(mLists->mGraph->size(), false);
+        }
+        std::vector<std::pair<uint32_t, uint32_t> > around;
+        neighbors(known, around);
+        mLists->mUnknownNeighbors[known] = true;
+        markStale(known);
+        for (size_t i = 0; i < around.size(); i++) {
+            markStale(around[i].first);
+        }
+    }
+}
+
+void CooccurrenceIndex::apply(const std::string& one, const std::string& two, uint32_t weight) {
+    pthread_mutex_lock(&mLock);
+    applyLocked(one, two, weight);
+    pthread_mutex_unlock(&mLock);
+    reclaim();
+}
+
+void CooccurrenceIndex::linkAdded(Node* one, Node* two, uint32_t weight) {
+    apply(one->getId(), two->getId(), weight);
+}
+
+// Applies the links to the current lists, and unless the snapshot is
+// an overlay, rebuilds on it, since it already holds the links.  While
+// a rebuild runs, the snapshot waits for it, replacing any snapshot
+// that was waiting already.
+void CooccurrenceIndex::snapshotPublished(LiveGraph* live, CsrGraph* snapshot, const std::vector<CsrLink>& links) {
+    pthread_mutex_lock(&mLock);
+    for (size_t i = 0; i < links.size(); i++) {
+        applyLocked(links[i].mOne, links[i].mTwo, links[i].mWeight);
+    }
+    pthread_mutex_unlock(&mLock);
+    reclaim();
+    if (snapshot->isOverlay()) {
+        return;
+    }
+
+    live->retain(snapshot);
+    pthread_mutex_lock(&mLock);
+    mLive = live;
+    CsrGraph* replaced = mNextGraph;
+    bool busy = mRebuilding;
+    if (busy) {
+        mNextGraph = snapshot;
+        mNextReplay.clear();
+    } else {
+        mRebuilding = true;
+        mRebuildGraph = snapshot;
+        mReplay.clear();
+    }
+    pthread_mutex_unlock(&mLock);
+    if (busy) {
+        if (replaced) {
+            live->release(replaced);
+        }
+        return;
+    }
+
+    if (mRebuilderStarted) {
+        pthread_join(mRebuilder, NULL);
+    }
+    mRebuilderStarted = pthread_create(&mRebuilder, NULL, rebuildThread, this) == 0;
+    if (!mRebuilderStarted) {
+        std::cerr << "Could not start index rebuild." << std::endl;
+        live->release(snapshot);
+        pthread_mutex_lock(&mLock);
+        mRebuilding = false;
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+uint64_t CooccurrenceIndex::getApplied() {
+    pthread_mutex_lock(&mLock);
+    uint64_t applied = mApplied;
+    pthread_mutex_unlock(&mLock);
+    return applied;
+}
+
+uint64_t CooccurrenceIndex::getUnindexed() {
+    pthread_mutex_lock(&mLock);
+    uint64_t unindexed = mUnindexed;
+    pthread_mutex_unlock(&mLock);
+    return unindexed;
+}
+
+uint64_t CooccurrenceIndex::getRebuilds() {
+    pthread_mutex_lock(&mLock);
+    uint64_t rebuilds = mRebuilds;
+    pthread_mutex_unlock(&mLock);
+    return rebuilds;
+}
+
+// The flat arrays plus the lists changed since they were built.
+size_t CooccurrenceIndex::getBytes() {
+    pthread_mutex_lock(&mLock);
+    size_t bytes = (mLists->mSizes.size() + mLists->mIds.size()) * sizeof(uint32_t) + mLists->mScores.size() * sizeof(uint64_t) + mLists->mChanged.size() * sizeof(List*);
+    for (size_t i = 0; i < mLists->mChanged.size(); i++) {
+        if (mLists->mChanged[i]) {
+            bytes += sizeof(List) + mLists->mChanged[i]->mEntries.capacity() * sizeof(std::pair<uint32_t, uint64_t>);
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return bytes;
+}
@@ -0,0 +1,120 @@
+#ifndef COOCCURRENCE_INDEX_HPP
+#define COOCCURRENCE_INDEX_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include "csr_graph.hpp"
+#include "recommend.hpp"
+#include "graph.hpp"
+#include "live_graph.hpp"
+#include "reader_epochs.hpp"
+
+/*
+ * Precomputed top N recommendations of every node whose name starts
+ * with a given prefix, scored exactly like recommend() does by default,
+ * with SCORE_MULTIPLICITY.  Those nodes
+ * form one id range of the CsrGraph, so the lists live in flat arrays
+ * of N slots per node and a lookup is a single array access.  Lists
+ * shorter than N are complete; longer requests have to go to
+ * recommend() instead.  N trades memory (12 bytes per slot) against how
+ * many requests the index answers.
+ *
+ * As a link listener of a Graph, or a snapshot listener of a LiveGraph,
+ * the index applies links between nodes of its CsrGraph as they
+ * arrive, adjusting only the pairs they change.  A link to a node the
+ * CsrGraph does not know marks the lists it changes as stale instead,
+ * and lookups of stale or unknown tracks are left to recommend() on a
+ * newer graph.
+ *
+ * Lookups take no lock.  A list a link changes is copied, changed and
+ * swapped in with a pointer store, and the list it replaced is deleted
+ * once ReaderEpochs shows no lookup can still be reading it.  Writers
+ * take turns on a mutex.
+ *
+ * Every snapshot that is not an overlay, so every compaction of a
+ * LiveGraph, starts a rebuild on it in the background, which replays
+ * the links that came in meanwhile and then takes the place of the
+ * current lists, dropping the added links and stale marks.  The index
+ * retains the snapshot for as long as it uses it.  Only one rebuild
+ * runs at a time; of the compactions during one, the last is rebuilt
+ * next.
+ */
+class CooccurrenceIndex : public LinkListener, public SnapshotListener {
+private:
+    /* A list changed since the build, never changed again in place. */
+    struct List {
+        bool mStale;
+        std::vector<std::pair<uint32_t, uint64_t> > mEntries;
+    };
+
+    /*
+     * The lists built on one graph and what links changed since, which
+     * a rebuild replaces all at once.
+     */
+    struct Lists {
+        CsrGraph* mGraph;
+        CsrGraph* mRetainedGraph;
+        uint32_t mFirst;
+        uint32_t mLast;
+        std::vector<uint32_t> mSizes;
+        std::vector<uint32_t> mIds;
+        std::vector<uint64_t> mScores;
+        std::vector<List*> mChanged;
+        std::map<uint32_t, std::vector<std::pair<uint32_t, uint32_t> > > mAdded;
+        std::vector<bool> mUnknownNeighbors;
+    };
+
+    size_t mTopN;
+    Lists* mLists;
+    ReaderEpochs mReaders;
+    pthread_mutex_t mLock;
+    std::vector<List*> mRetired;
+    uint64_t mApplied;
+    uint64_t mUnindexed;
+    uint32_t mNextBlock;
+    ScoreCounter mCounter;
+
+    std::string mPrefix;
+    LiveGraph* mLive;
+    CsrGraph* mRebuildGraph;
+    std::vector<CsrLink> mReplay;
+    CsrGraph* mNextGraph;
+    std::vector<CsrLink> mNextReplay;
+    bool mRebuilding;
+    bool mRebuilderStarted;
+    pthread_t mRebuilder;
+    uint64_t mRebuilds;
+
+    CooccurrenceIndex(const CooccurrenceIndex&);
+    CooccurrenceIndex& operator=(const CooccurrenceIndex&);
+    static void* buildThread(void*);
+    static void* rebuildThread(void*);
+    void neighbors(uint32_t, std::vector<std::pair<uint32_t, uint32_t> >&);
+    void rank(uint32_t, ScoreCounter&, std::vector<std::pair<uint32_t, uint64_t> >&);
+    uint64_t pairScore(uint32_t, uint32_t);
+    bool current(uint32_t, std::vector<std::pair<uint32_t, uint64_t> >&);
+    void replace(uint32_t, std::vector<std::pair<uint32_t, uint64_t> >&, bool);
+    void markStale(uint32_t);
+    void raise(uint32_t, uint32_t);
+    void addLinkLocked(uint32_t, uint32_t, uint32_t);
+    void applyLocked(const std::string&, const std::string&, uint32_t);
+    void apply(const std::string&, const std::string&, uint32_t);
+    void reclaim();
+    void deleteLists(Lists*);
+public:
+    CooccurrenceIndex(CsrGraph*, const std::string&, size_t, unsigned int);
+    ~CooccurrenceIndex();
+    bool lookup(const std::string&, size_t, std::vector<std::pair<std::string, uint64_t> >&);
+    void addLink(uint32_t, uint32_t, uint32_t);
+    void linkAdded(Node*, Node*, uint32_t);
+    void snapshotPublished(LiveGraph*, CsrGraph*, const std::vector<CsrLink>&);
+    uint64_t getApplied();
+    uint64_t getUnindexed();
+    uint64_t getRebuilds();
+    size_t getBytes();
+};
+
+#endif
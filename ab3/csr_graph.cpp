@@ -0,0 +1,630 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "csr_graph.hpp"
+#include "utils.hpp"
+
+namespace {
+
+/*
+ * A snapshot is this header followed by the offsets, name offsets,
+ * slot, neighbor, weight and name arrays, each padded to 8 bytes.  Everything
+ * is stored in native byte order; a file written on a machine of the
+ * other order fails the version check.  The checksum covers all bytes
+ * after the header.
+ */
+const char snapshotMagic[8] = {'A', 'B', '3', 'G', 'R', 'A', 'P', 'H'};
+const uint32_t snapshotVersion = 2;
+
+struct SnapshotHeader {
+    char mMagic[8];
+    uint32_t mVersion;
+    uint32_t mNodes;
+    uint64_t mEdges;
+    uint64_t mNameBytes;
+    uint64_t mSlots;
+    uint64_t mChecksum;
+};
+
+uint64_t padded(uint64_t bytes) {
+    return (bytes + 7) & ~(uint64_t) 7;
+}
+
+// Whether offsets start at zero, never decrease and end at total.
+bool validOffsets(const uint64_t* offsets, uint32_t nodes, uint64_t total) {
+    if (offsets[0] != 0 || offsets[nodes] != total) {
+        return false;
+    }
+    for (uint32_t i = 0; i < nodes; i++) {
+        if (offsets[i] > offsets[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether every list holds ids of existing nodes in increasing order,
+// so that serving never reads outside the arrays.
+bool validNeighbors(const uint64_t* offsets, const uint32_t* neighbors, uint32_t nodes) {
+    for (uint32_t i = 0; i < nodes; i++) {
+        for (uint64_t j = offsets[i]; j < offsets[i + 1]; j++) {
+            if (neighbors[j] >= nodes || (j > offsets[i] && neighbors[j] <= neighbors[j - 1])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether every slot is empty or holds an existing id, with at most one
+// slot per node, so that lookups always reach an empty slot.
+bool validSlots(const uint32_t* slots, uint64_t count, uint32_t nodes) {
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (slots[i] > nodes) {
+            return false;
+        }
+        used += slots[i] != 0;
+    }
+    return used <= nodes;
+}
+
+// FNV-1a over 8-byte words, with the last word of each section padded
+// with zeros like the section is in the file.
+class Checksum {
+private:
+    uint64_t mHash;
+public:
+    Checksum() : mHash(14695981039346656037ULL) {}
+    void add(const void* data, uint64_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        for (uint64_t i = 0; i < size; i += 8) {
+            uint64_t word = 0;
+            memcpy(&word, bytes + i, size - i < 8 ? size - i : 8);
+            mHash = (mHash ^ word) * 1099511628211ULL;
+        }
+    }
+    uint64_t get() const {
+        return mHash;
+    }
+};
+
+}
+
+CsrGraph::CsrGraph() : mSize(0), mSlotCount(0), mMapping(NULL), mMappingSize(0), mBaseGraph(NULL), mBaseRows(0), mEdges(0) {
+}
+
+CsrGraph::CsrGraph(Graph* graph) : mSize(0), mSlotCount(0), mMapping(NULL), mMappingSize(0), mBaseGraph(NULL), mBaseRows(0), mEdges(0) {
+    std::vector<uint32_t> order = graph->mIds->sortedIds();
+    std::vector<uint32_t> remap(order.size());
+    IdDictionary ids;
+    uint64_t edges = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        remap[order[i]] = ids.intern(graph->mIds->getName(order[i]));
+        edges += graph->mNodes->at(order[i])->getNeighbors()->size();
+    }
+
+    // Repeated links are merged per node by sorting, adding up their
+    // weights.
+    mOffsets.reserve(order.size() + 1);
+    mNeighbors.reserve(edges);
+    mWeights.reserve(edges);
+    mOffsets.push_back(0);
+    std::vector<std::pair<uint32_t, uint32_t> > links;
+    for (size_t i = 0; i < order.size(); i++) {
+        std::vector<Node*>* neighbors = graph->mNodes->at(order[i])->getNeighbors();
+        std::vector<uint32_t>* weights = graph->mNodes->at(order[i])->getWeights();
+        links.clear();
+        for (size_t j = 0; j < neighbors->size(); j++) {
+            links.push_back(std::make_pair(remap[neighbors->at(j)->getIndex()], weights->at(j)));
+        }
+        std::sort(links.begin(), links.end());
+        for (size_t j = 0; j < links.size(); j++) {
+            if (j > 0 && links[j].first == links[j - 1].first) {
+                mWeights.back() = add_weight(mWeights.back(), links[j].second);
+            } else {
+                mNeighbors.push_back(links[j].first);
+                mWeights.push_back(links[j].second);
+            }
+        }
+        mOffsets.push_back(mNeighbors.size());
+    }
+    freeze(ids);
+}
+
+// Takes over the adjacency arrays, whose lists must already be sorted
+// and unique.  The ids of the dictionary must be in name order.
+CsrGraph::CsrGraph(IdDictionary& ids, std::vector<uint64_t>& offsets, std::vector<uint32_t>& neighbors, std::vector<uint32_t>& weights) : mSize(0), mSlotCount(0), mMapping(NULL), mMappingSize(0), mBaseGraph(NULL), mBaseRows(0), mEdges(0) {
+    mOffsets.swap(offsets);
+    mNeighbors.swap(neighbors);
+    mWeights.swap(weights);
+    freeze(ids);
+}
+
+CsrGraph::~CsrGraph() {
+    if (mMapping) {
+        munmap(mMapping, mMappingSize);
+    }
+}
+
+// Copies the names into the flat buffer and indexes them.
+void CsrGraph::freeze(const IdDictionary& ids) {
+    mSize = ids.size();
+    mNameOffsets.reserve(mSize + 1);
+    mNameOffsets.push_back(0);
+    for (uint32_t id = 0; id < mSize; id++) {
+        const std::string& name = ids.getName(id);
+        mNames.insert(mNames.end(), name.begin(), name.end());
+        mNameOffsets.push_back(mNames.size());
+    }
+    index();
+}
+
+// Builds the lookup table over the flat names and points everything at
+// the vectors.
+void CsrGraph::index() {
+    mSize = mNameOffsets.size() - 1;
+    mSlotCount = 16;
+    while (mSlotCount < 2 * (uint64_t) mSize) {
+        mSlotCount *= 2;
+    }
+    mSlots.assign(mSlotCount, 0);
+    const char* names = mNames.empty() ? NULL : &mNames[0];
+    for (uint32_t id = 0; id < mSize; id++) {
+        uint64_t slot = hashName(names + mNameOffsets[id], mNameOffsets[id + 1] - mNameOffsets[id]) & (mSlotCount - 1);
+        while (mSlots[slot]) {
+            slot = (slot + 1) & (mSlotCount - 1);
+        }
+        mSlots[slot] = id + 1;
+    }
+
+    mOffsetData = &mOffsets[0];
+    mNeighborData = mNeighbors.empty() ? NULL : &mNeighbors[0];
+    mWeightData = mWeights.empty() ? NULL : &mWeights[0];
+    mNameOffsetData = &mNameOffsets[0];
+    mNameData = names;
+    mSlotData = &mSlots[0];
+}
+
+// Compares the name of the node with the given one the way
+// std::string does.
+int CsrGraph::compareName(uint32_t id, const std::string& name) {
+    size_t size = mNameOffsetData[id + 1] - mNameOffsetData[id];
+    int order = memcmp(mNameData + mNameOffsetData[id], name.data(), std::min(size, name.size()));
+    if (order != 0) {
+        return order;
+    }
+    return size < name.size() ? -1 : size > name.size();
+}
+
+// A copy of base with the links added in both directions.  New names
+// are merged into the name order, which only shifts the ids of the old
+// nodes, so their lists stay sorted after renumbering and each one is
+// merged with its new links in a single pass.  base must not be an
+// overlay.
+CsrGraph::CsrGraph(CsrGraph* base, const std::vector<CsrLink>& links) : mSize(0), mSlotCount(0), mMapping(NULL), mMappingSize(0), mBaseGraph(NULL), mBaseRows(0), mEdges(0) {
+    std::vector<std::string> added;
+    uint32_t id;
+    for (size_t i = 0; i < links.size(); i++) {
+        if (!base->findId(links[i].mOne, id)) {
+            added.push_back(links[i].mOne);
+        }
+        if (!base->findId(links[i].mTwo, id)) {
+            added.push_back(links[i].mTwo);
+        }
+    }
+    std::sort(added.begin(), added.end());
+    added.erase(std::unique(added.begin(), added.end()), added.end());
+
+    uint32_t baseSize = base->size();
+    std::vector<uint32_t> remap(baseSize);
+    std::vector<uint32_t> addedIds(added.size());
+    std::vector<bool> fromBase;
+    fromBase.reserve(baseSize + added.size());
+    mNameOffsets.reserve(baseSize + added.size() + 1);
+    mNames.reserve(base->mNameOffsetData[baseSize] + added.size() * 16);
+    mNameOffsets.push_back(0);
+    uint32_t next = 0;
+    size_t k = 0;
+    for (uint32_t i = 0; i < baseSize || k < added.size(); next++) {
+        if (k == added.size() || (i < baseSize && base->compareName(i, added[k]) < 0)) {
+            mNames.insert(mNames.end(), base->mNameData + base->mNameOffsetData[i], base->mNameData + base->mNameOffsetData[i + 1]);
+            fromBase.push_back(true);
+            remap[i++] = next;
+        } else {
+            mNames.insert(mNames.end(), added[k].begin(), added[k].end());
+            fromBase.push_back(false);
+            addedIds[k++] = next;
+        }
+        mNameOffsets.push_back(mNames.size());
+    }
+
+    std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t> > > edges;
+    edges.reserve(2 * links.size());
+    for (size_t i = 0; i < links.size(); i++) {
+        uint32_t one;
+        uint32_t two;
+        if (base->findId(links[i].mOne, one)) {
+            one = remap[one];
+        } else {
+            one = addedIds[std::lower_bound(added.begin(), added.end(), links[i].mOne) - added.begin()];
+        }
+        if (base->findId(links[i].mTwo, two)) {
+            two = remap[two];
+        } else {
+            two = addedIds[std::lower_bound(added.begin(), added.end(), links[i].mTwo) - added.begin()];
+        }
+        edges.push_back(std::make_pair(one, std::make_pair(two, links[i].mWeight)));
+        edges.push_back(std::make_pair(two, std::make_pair(one, links[i].mWeight)));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    mOffsets.reserve(next + 1);
+    mNeighbors.reserve(base->mOffsetData[baseSize] + edges.size());
+    mWeights.reserve(base->mOffsetData[baseSize] + edges.size());
+    mOffsets.push_back(0);
+    uint32_t old = 0;
+    size_t e = 0;
+    for (uint32_t node = 0; node < next; node++) {
+        uint64_t j = 0;
+        uint64_t end = 0;
+        if (fromBase[node]) {
+            j = base->mOffsetData[old];
+            end = base->mOffsetData[old + 1];
+            old++;
+        }
+        uint64_t first = mNeighbors.size();
+        while (j < end || (e < edges.size() && edges[e].first == node)) {
+            uint32_t neighbor;
+            uint32_t weight;
+            if (e == edges.size() || edges[e].first != node || (j < end && remap[base->mNeighborData[j]] <= edges[e].second.first)) {
+                neighbor = remap[base->mNeighborData[j]];
+                weight = base->mWeightData[j++];
+            } else {
+                neighbor = edges[e].second.first;
+                weight = edges[e++].second.second;
+            }
+            if (mNeighbors.size() > first && mNeighbors.back() == neighbor) {
+                mWeights.back() = add_weight(mWeights.back(), weight);
+            } else {
+                mNeighbors.push_back(neighbor);
+                mWeights.push_back(weight);
+            }
+        }
+        mOffsets.push_back(mNeighbors.size());
+    }
+    index();
+}
+
+// Reads like a copy of base with the links added in both directions,
+// but only rewrites the lists of the nodes the links touch and keeps
+// the names of new nodes.  Everything else is read from base, which
+// must outlive the overlay and must not be an overlay itself.  Costs
+// time in the links and those lists instead of the whole graph.
+CsrGraph* CsrGraph::overlay(CsrGraph* base, const std::vector<CsrLink>& links) {
+    std::vector<std::string> added;
+    uint32_t id;
+    for (size_t i = 0; i < links.size(); i++) {
+        if (!base->findId(links[i].mOne, id)) {
+            added.push_back(links[i].mOne);
+        }
+        if (!base->findId(links[i].mTwo, id)) {
+            added.push_back(links[i].mTwo);
+        }
+    }
+    std::sort(added.begin(), added.end());
+    added.erase(std::unique(added.begin(), added.end()), added.end());
+
+    // New nodes get the ids after those of base, in name order, and
+    // remember where they fall among the names of base.
+    CsrGraph* graph = new CsrGraph();
+    graph->mBaseGraph = base;
+    uint32_t baseSize = base->size();
+    graph->mNameOffsets.reserve(added.size() + 1);
+    graph->mNameOffsets.push_back(0);
+    graph->mAddedPositions.reserve(added.size());
+    uint32_t low = 0;
+    for (size_t k = 0; k < added.size(); k++) {
+        graph->mNames.insert(graph->mNames.end(), added[k].begin(), added[k].end());
+        graph->mNameOffsets.push_back(graph->mNames.size());
+        uint32_t high = baseSize;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            if (base->compareName(middle, added[k]) < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        graph->mAddedPositions.push_back(low);
+    }
+
+    std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t> > > edges;
+    edges.reserve(2 * links.size());
+    for (size_t i = 0; i < links.size(); i++) {
+        uint32_t one;
+        uint32_t two;
+        if (!base->findId(links[i].mOne, one)) {
+            one = baseSize + (std::lower_bound(added.begin(), added.end(), links[i].mOne) - added.begin());
+        }
+        if (!base->findId(links[i].mTwo, two)) {
+            two = baseSize + (std::lower_bound(added.begin(), added.end(), links[i].mTwo) - added.begin());
+        }
+        edges.push_back(std::make_pair(one, std::make_pair(two, links[i].mWeight)));
+        edges.push_back(std::make_pair(two, std::make_pair(one, links[i].mWeight)));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    // Every touched node gets a row with its list from base merged with
+    // its new links.  Old nodes are flagged in a bitmap, so that lookups
+    // of the others stay cheap, and their rows are found through a small
+    // open-addressing table from id to row.
+    std::vector<uint32_t> changed;
+    graph->mChanged.assign(baseSize, false);
+    uint64_t replaced = 0;
+    graph->mOffsets.push_back(0);
+    for (size_t e = 0; e < edges.size();) {
+        uint32_t node = edges[e].first;
+        uint64_t j = 0;
+        uint64_t end = 0;
+        if (node < baseSize) {
+            j = base->mOffsetData[node];
+            end = base->mOffsetData[node + 1];
+            replaced += end - j;
+            changed.push_back(node);
+            graph->mChanged[node] = true;
+        }
+        uint64_t first = graph->mNeighbors.size();
+        while (j < end || (e < edges.size() && edges[e].first == node)) {
+            uint32_t neighbor;
+            uint32_t weight;
+            if (e == edges.size() || edges[e].first != node || (j < end && base->mNeighborData[j] <= edges[e].second.first)) {
+                neighbor = base->mNeighborData[j];
+                weight = base->mWeightData[j++];
+            } else {
+                neighbor = edges[e].second.first;
+                weight = edges[e++].second.second;
+            }
+            if (graph->mNeighbors.size() > first && graph->mNeighbors.back() == neighbor) {
+                graph->mWeights.back() = add_weight(graph->mWeights.back(), weight);
+            } else {
+                graph->mNeighbors.push_back(neighbor);
+                graph->mWeights.push_back(weight);
+            }
+        }
+        graph->mOffsets.push_back(graph->mNeighbors.size());
+    }
+    uint64_t rowSlots = 16;
+    while (rowSlots < 2 * (uint64_t) changed.size()) {
+        rowSlots *= 2;
+    }
+    graph->mRows.assign(rowSlots, 0);
+    for (uint32_t row = 0; row < changed.size(); row++) {
+        uint64_t slot = hashName(reinterpret_cast<const char*>(&changed[row]), sizeof(uint32_t)) & (rowSlots - 1);
+        while (graph->mRows[slot]) {
+            slot = (slot + 1) & (rowSlots - 1);
+        }
+        graph->mRows[slot] = (uint64_t) (changed[row] + 1) << 32 | row;
+    }
+    graph->mBaseRows = changed.size();
+
+    graph->index();
+    graph->mSize = baseSize + added.size();
+    graph->mEdges = base->getEdges() - replaced + graph->mNeighbors.size();
+    return graph;
+}
+
+// Maps a snapshot written by save().  Pages are only read when
+// touched, and stay shared with other processes mapping the same file.
+// The offsets, neighbor ids and slots are always checked, so that a
+// corrupt file cannot make lookups read out of bounds.  Checking the
+// checksum reads the whole file, names and weights included, so it is
+// optional.
+CsrGraph* CsrGraph::load(const std::string& filename, bool verify) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        std::cerr << "Could not open snapshot file." << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    size_t size = info.st_size;
+    void* mapping = size >= sizeof(SnapshotHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Invalid snapshot file." << std::endl;
+        return NULL;
+    }
+
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(mapping);
+    const char* data = static_cast<const char*>(mapping) + sizeof(SnapshotHeader);
+    bool valid = memcmp(header->mMagic, snapshotMagic, sizeof(snapshotMagic)) == 0 && header->mVersion == snapshotVersion;
+    valid = valid && header->mEdges <= size && header->mNameBytes <= size && header->mSlots <= size;
+    valid = valid && header->mSlots >= 2ULL * header->mNodes && header->mSlots >= 16 && (header->mSlots & (header->mSlots - 1)) == 0;
+    uint64_t offsetBytes = padded((header->mNodes + 1ULL) * sizeof(uint64_t));
+    uint64_t slotBytes = padded(header->mSlots * sizeof(uint32_t));
+    uint64_t neighborBytes = padded(header->mEdges * sizeof(uint32_t));
+    uint64_t payload = 2 * offsetBytes + slotBytes + 2 * neighborBytes + padded(header->mNameBytes);
+    valid = valid && sizeof(SnapshotHeader) + payload == size;
+    if (valid) {
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data);
+        const uint64_t* nameOffsets = reinterpret_cast<const uint64_t*>(data + offsetBytes);
+        const uint32_t* slots = reinterpret_cast<const uint32_t*>(data + 2 * offsetBytes);
+        const uint32_t* neighbors = reinterpret_cast<const uint32_t*>(data + 2 * offsetBytes + slotBytes);
+        valid = validOffsets(offsets, header->mNodes, header->mEdges) && validOffsets(nameOffsets, header->mNodes, header->mNameBytes);
+        valid = valid && validNeighbors(offsets, neighbors, header->mNodes) && validSlots(slots, header->mSlots, header->mNodes);
+    }
+    if (valid && verify) {
+        Checksum checksum;
+        checksum.add(data, payload);
+        valid = checksum.get() == header->mChecksum;
+    }
+    if (!valid) {
+        std::cerr << "Invalid snapshot file." << std::endl;
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    CsrGraph* graph = new CsrGraph();
+    graph->mMapping = mapping;
+    graph->mMappingSize = size;
+    graph->mSize = header->mNodes;
+    graph->mSlotCount = header->mSlots;
+    graph->mOffsetData = reinterpret_cast<const uint64_t*>(data);
+    graph->mNameOffsetData = reinterpret_cast<const uint64_t*>(data + offsetBytes);
+    graph->mSlotData = reinterpret_cast<const uint32_t*>(data + 2 * offsetBytes);
+    graph->mNeighborData = reinterpret_cast<const uint32_t*>(data + 2 * offsetBytes + slotBytes);
+    graph->mWeightData = reinterpret_cast<const uint32_t*>(data + 2 * offsetBytes + slotBytes + neighborBytes);
+    graph->mNameData = data + 2 * offsetBytes + slotBytes + 2 * neighborBytes;
+    return graph;
+}
+
+// Writes to a temporary file first and renames it into place, so that
+// servers never map a half-written snapshot.
+bool CsrGraph::save(const std::string& filename) {
+    if (mBaseGraph) {
+        std::cerr << "Overlays cannot be saved as snapshots." << std::endl;
+        return false;
+    }
+    const void* sections[] = {mOffsetData, mNameOffsetData, mSlotData, mNeighborData, mWeightData, mNameData};
+    uint64_t sizes[] = {(mSize + 1ULL) * sizeof(uint64_t), (mSize + 1ULL) * sizeof(uint64_t), mSlotCount * sizeof(uint32_t), mOffsetData[mSize] * sizeof(uint32_t), mOffsetData[mSize] * sizeof(uint32_t), mNameOffsetData[mSize]};
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.mMagic, snapshotMagic, sizeof(snapshotMagic));
+    header.mVersion = snapshotVersion;
+    header.mNodes = mSize;
+    header.mEdges = mOffsetData[mSize];
+    header.mNameBytes = mNameOffsetData[mSize];
+    header.mSlots = mSlotCount;
+    Checksum checksum;
+    for (size_t i = 0; i < 6; i++) {
+        checksum.add(sections[i], sizes[i]);
+    }
+    header.mChecksum = checksum.get();
+
+    std::string temporary = filename + ".tmp";
+    std::ofstream output(temporary.c_str(), std::ios::binary);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const char padding[8] = {0};
+    for (size_t i = 0; i < 6; i++) {
+        output.write(static_cast<const char*>(sections[i]), sizes[i]);
+        output.write(padding, padded(sizes[i]) - sizes[i]);
+    }
+    output.close();
+    if (!output || rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Could not write snapshot file." << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint32_t CsrGraph::size() {
+    return mSize;
+}
+
+// Where the list of the node is in the own arrays.  Overlays only have
+// rows for the nodes they changed and leave the rest to their base.
+bool CsrGraph::findRow(uint32_t id, uint32_t& row) {
+    if (!mBaseGraph) {
+        row = id;
+        return true;
+    }
+    if (id >= mBaseGraph->mSize) {
+        row = mBaseRows + (id - mBaseGraph->mSize);
+        return true;
+    }
+    if (!mChanged[id]) {
+        return false;
+    }
+    uint64_t mask = mRows.size() - 1;
+    for (uint64_t slot = hashName(reinterpret_cast<const char*>(&id), sizeof(id)) & mask; mRows[slot]; slot = (slot + 1) & mask) {
+        if (mRows[slot] >> 32 == id + 1ULL) {
+            row = (uint32_t) mRows[slot];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CsrGraph::findId(const std::string& name, uint32_t& id) {
+    if (mBaseGraph && mBaseGraph->findId(name, id)) {
+        return true;
+    }
+    uint64_t slot = hashName(name.data(), name.size()) & (mSlotCount - 1);
+    while (mSlotData[slot]) {
+        uint32_t candidate = mSlotData[slot] - 1;
+        uint64_t begin = mNameOffsetData[candidate];
+        uint64_t length = mNameOffsetData[candidate + 1] - begin;
+        if (length == name.size() && memcmp(mNameData + begin, name.data(), length) == 0) {
+            id = mBaseGraph ? mBaseGraph->mSize + candidate : candidate;
+            return true;
+        }
+        slot = (slot + 1) & (mSlotCount - 1);
+    }
+    return false;
+}
+
+std::string CsrGraph::getName(uint32_t id) {
+    if (mBaseGraph) {
+        if (id < mBaseGraph->mSize) {
+            return mBaseGraph->getName(id);
+        }
+        id -= mBaseGraph->mSize;
+    }
+    return std::string(mNameData + mNameOffsetData[id], mNameOffsetData[id + 1] - mNameOffsetData[id]);
+}
+
+const uint32_t* CsrGraph::getNeighbors(uint32_t id) {
+    uint32_t row;
+    if (!findRow(id, row)) {
+        return mBaseGraph->getNeighbors(id);
+    }
+    return mNeighborData ? mNeighborData + mOffsetData[row] : NULL;
+}
+
+const uint32_t* CsrGraph::getWeights(uint32_t id) {
+    uint32_t row;
+    if (!findRow(id, row)) {
+        return mBaseGraph->getWeights(id);
+    }
+    return mWeightData ? mWeightData + mOffsetData[row] : NULL;
+}
+
+uint64_t CsrGraph::getDegree(uint32_t id) {
+    uint32_t row;
+    if (!findRow(id, row)) {
+        return mBaseGraph->getDegree(id);
+    }
+    return mOffsetData[row + 1] - mOffsetData[row];
+}
+
+uint64_t CsrGraph::getEdges() {
+    return mBaseGraph ? mEdges : mOffsetData[mSize];
+}
+
+// Whether the name of the first node sorts before that of the second,
+// without looking at either name.
+bool CsrGraph::nameLess(uint32_t one, uint32_t two) {
+    if (!mBaseGraph || (one < mBaseGraph->mSize) == (two < mBaseGraph->mSize)) {
+        return one < two;
+    }
+    if (one >= mBaseGraph->mSize) {
+        return mAddedPositions[one - mBaseGraph->mSize] <= two;
+    }
+    return mAddedPositions[two - mBaseGraph->mSize] > one;
+}
+
+bool CsrGraph::isOverlay() {
+    return mBaseGraph != NULL;
+}
@@ -0,0 +1,97 @@
+#ifndef CSR_GRAPH_HPP
+#define CSR_GRAPH_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "graph.hpp"
+#include "id_dictionary.hpp"
+
+/* A link to add to a CsrGraph, by the names of its two ends. */
+struct CsrLink {
+    std::string mOne;
+    std::string mTwo;
+    uint32_t mWeight;
+};
+
+/*
+ * Frozen, compressed sparse row form of a Graph.  Nodes get dense ids
+ * in name order, so comparing ids orders nodes the same way as
+ * comparing their names.  The neighbors of node i are
+ * neighbors[offsets[i]] up to neighbors[offsets[i + 1]], sorted and
+ * unique, and weights holds the weight of each of those edges: the sum
+ * of the weights of all links between the two nodes.
+ *
+ * Names are kept back to back in one buffer, with an open-addressing
+ * table of ids for lookups.  All arrays are flat, so a graph can be
+ * saved as a snapshot file and later served straight from a read-only
+ * mapping of it.
+ *
+ * An overlay made by overlay() reads like a merged copy of its base,
+ * but only holds the lists and names that differ from it.  Its new
+ * nodes are numbered after those of the base, so their ids alone do not
+ * follow name order; nameLess() does.
+ */
+class CsrGraph {
+private:
+    std::vector<uint64_t> mOffsets;
+    std::vector<uint32_t> mNeighbors;
+    std::vector<uint32_t> mWeights;
+    std::vector<uint64_t> mNameOffsets;
+    std::vector<char> mNames;
+    std::vector<uint32_t> mSlots;
+
+    /* Point either into the vectors above or into a mapped snapshot. */
+    uint32_t mSize;
+    uint64_t mSlotCount;
+    const uint64_t* mOffsetData;
+    const uint32_t* mNeighborData;
+    const uint32_t* mWeightData;
+    const uint64_t* mNameOffsetData;
+    const char* mNameData;
+    const uint32_t* mSlotData;
+
+    void* mMapping;
+    size_t mMappingSize;
+
+    /*
+     * Set for overlays, whose own arrays then only hold the rows of the
+     * nodes they changed: first the old nodes, flagged in changed and
+     * found through rows, then every new node in id order.  For each
+     * new node, added positions holds how many names of the base sort
+     * before it.
+     */
+    CsrGraph* mBaseGraph;
+    uint32_t mBaseRows;
+    uint64_t mEdges;
+    std::vector<bool> mChanged;
+    std::vector<uint64_t> mRows;
+    std::vector<uint32_t> mAddedPositions;
+
+    CsrGraph();
+    CsrGraph(const CsrGraph&);
+    CsrGraph& operator=(const CsrGraph&);
+    void freeze(const IdDictionary&);
+    void index();
+    int compareName(uint32_t, const std::string&);
+    bool findRow(uint32_t, uint32_t&);
+public:
+    CsrGraph(Graph*);
+    CsrGraph(IdDictionary&, std::vector<uint64_t>&, std::vector<uint32_t>&, std::vector<uint32_t>&);
+    CsrGraph(CsrGraph*, const std::vector<CsrLink>&);
+    ~CsrGraph();
+    static CsrGraph* overlay(CsrGraph*, const std::vector<CsrLink>&);
+    static CsrGraph* load(const std::string&, bool);
+    bool save(const std::string&);
+    uint32_t size();
+    bool findId(const std::string&, uint32_t&);
+    std::string getName(uint32_t);
+    const uint32_t* getNeighbors(uint32_t);
+    const uint32_t* getWeights(uint32_t);
+    uint64_t getDegree(uint32_t);
+    uint64_t getEdges();
+    bool nameLess(uint32_t, uint32_t);
+    bool isOverlay();
+};
+
+#endif
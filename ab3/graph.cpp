@@ -1,37 +1,40 @@
 #include "graph.hpp"
 
 Graph::Graph() {
-    mGraph = new std::map<std::string, Node*>;
+    mIds = new IdDictionary;
+    mNodes = new std::vector<Node*>;
+    mListeners = new std::vector<LinkListener*>;
 }
 
 Graph::~Graph() {
-    std::map<std::string, Node*>::const_iterator it = mGraph->begin();
-    while (it != mGraph->end()) {
-        delete it->second;
-        ++it;
+    for (size_t i = 0; i < mNodes->size(); i++) {
+        delete mNodes->at(i);
     }
-    delete mGraph;
+    delete mNodes;
+    delete mIds;
+    delete mListeners;
 }
 
 bool Graph::addNode(Node* node) {
-    std::pair<std::string, Node*> value(node->getId(), node);
-    std::pair<std::map<std::string, Node*>::const_iterator, bool> ret = mGraph->insert(value);
-    if (!ret.second) {
+    uint32_t index = mIds->intern(node->getId());
+    if (index < mNodes->size()) {
         delete node;
+        return false;
     }
-    return ret.second;
+    node->setIndex(index);
+    mNodes->push_back(node);
+    return true;
 }
 
 Node* Graph::getNode(std::string id) {
-    std::map<std::string, Node*>::const_iterator it;
-    it = mGraph->find(id);
-    if (it != mGraph->end()) {
-        return it->second;
+    uint32_t index;
+    if (mIds->find(id, index)) {
+        return mNodes->at(index);
     }
     return NULL;
 }
 
-void Graph::addLink(std::string one, std::string two, bool directed) {
+void Graph::addLink(std::string one, std::string two, bool directed, uint32_t weight) {
     Node* nodeOne = getNode(one);
     if (!nodeOne) {
         return;
@@ -41,17 +44,23 @@ void Graph::addLink(std::string one, std::string two, bool directed) {
         return;
     }
 
-    nodeOne->addNeighbor(nodeTwo);
+    nodeOne->addNeighbor(nodeTwo, weight);
     if (!directed) {
-        nodeTwo->addNeighbor(nodeOne);
+        nodeTwo->addNeighbor(nodeOne, weight);
     }
+    for (size_t i = 0; i < mListeners->size(); i++) {
+        mListeners->at(i)->linkAdded(nodeOne, nodeTwo, weight);
+    }
+}
+
+void Graph::addLinkListener(LinkListener* listener) {
+    mListeners->push_back(listener);
 }
 
 std::ostream& operator<<(std::ostream& os, Graph* graph) {
-    std::map<std::string, Node*>::const_iterator it = graph->mGraph->begin();
-    while (it != graph->mGraph->end()) {
-        os << it->second << std::endl;
-        ++it;
+    std::vector<uint32_t> order = graph->mIds->sortedIds();
+    for (size_t i = 0; i < order.size(); i++) {
+        os << graph->mNodes->at(order[i]) << std::endl;
     }
     return os;
 }
@@ -76,7 +85,8 @@ void populateGraph(std::string filename, Graph* graph) {
                 right = new Node(tokens.at(2));
                 graph->addNode(left);
                 graph->addNode(right);
-                graph->addLink(tokens.at(0), tokens.at(2), false);
+                uint32_t weight = tokens.size() > 3 ? parse_weight(tokens.at(3).data(), tokens.at(3).size()) : 1;
+                graph->addLink(tokens.at(0), tokens.at(2), false, weight);
             }
         }
     } else {
@@ -1,23 +1,38 @@
 #ifndef GRAPH_HPP
 #define GRAPH_HPP
 
-#include <map>
+#include <vector>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include "utils.hpp"
 #include "node.hpp"
+#include "id_dictionary.hpp"
+
+/*
+ * Told about every link added to a Graph, after both nodes have been
+ * updated.
+ */
+class LinkListener {
+public:
+    virtual ~LinkListener() {}
+    virtual void linkAdded(Node*, Node*, uint32_t) = 0;
+};
 
 class Graph {
 private:
-    std::map<std::string, Node*>* mGraph;
+    IdDictionary* mIds;
+    std::vector<Node*>* mNodes;
+    std::vector<LinkListener*>* mListeners;
 public:
     Graph();
     ~Graph();
     bool addNode(Node*);
     Node* getNode(std::string);
-    void addLink(std::string, std::string, bool);
+    void addLink(std::string, std::string, bool, uint32_t = 1);
+    void addLinkListener(LinkListener*);
     friend std::ostream& operator<<(std::ostream&, Graph*);
+    friend class CsrGraph;
 };
 
 std::ostream& operator<<(std::ostream&, Graph*);
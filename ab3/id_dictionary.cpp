@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstring>
+#include "id_dictionary.hpp"
+
+namespace {
+
+class NameLess {
+private:
+    const IdDictionary* mIds;
+public:
+    NameLess(const IdDictionary* ids) : mIds(ids) {}
+    bool operator()(uint32_t a, uint32_t b) const {
+        return mIds->getName(a) < mIds->getName(b);
+    }
+};
+
+}
+
+uint32_t hashName(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+IdDictionary::IdDictionary() : mSlots(16, 0) {
+}
+
+// Slots hold id + 1, so that 0 marks an empty slot.  Returns the slot
+// holding the name, or the empty slot where it would go.
+size_t IdDictionary::slotOf(const char* name, size_t length, uint32_t hash) const {
+    size_t mask = mSlots.size() - 1;
+    size_t slot = hash & mask;
+    while (mSlots[slot]) {
+        const std::string& candidate = mNames[mSlots[slot] - 1];
+        if (candidate.size() == length && memcmp(candidate.data(), name, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void IdDictionary::grow() {
+    std::vector<uint32_t> slots(mSlots.size() * 2, 0);
+    mSlots.swap(slots);
+    size_t mask = mSlots.size() - 1;
+    for (uint32_t id = 0; id < mNames.size(); id++) {
+        size_t slot = hashName(mNames[id].data(), mNames[id].size()) & mask;
+        while (mSlots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        mSlots[slot] = id + 1;
+    }
+}
+
+uint32_t IdDictionary::intern(const std::string& name) {
+    return intern(name.data(), name.size(), hashName(name.data(), name.size()));
+}
+
+// Takes the hash of the name from the caller, who may already have
+// computed it.
+uint32_t IdDictionary::intern(const char* name, size_t length, uint32_t hash) {
+    size_t slot = slotOf(name, length, hash);
+    if (mSlots[slot]) {
+        return mSlots[slot] - 1;
+    }
+
+    uint32_t id = mNames.size();
+    mNames.push_back(std::string(name, length));
+    mSlots[slot] = id + 1;
+    if (2 * mNames.size() > mSlots.size()) {
+        grow();
+    }
+    return id;
+}
+
+bool IdDictionary::find(const std::string& name, uint32_t& id) const {
+    size_t slot = slotOf(name.data(), name.size(), hashName(name.data(), name.size()));
+    if (!mSlots[slot]) {
+        return false;
+    }
+    id = mSlots[slot] - 1;
+    return true;
+}
+
+const std::string& IdDictionary::getName(uint32_t id) const {
+    return mNames[id];
+}
+
+uint32_t IdDictionary::size() const {
+    return mNames.size();
+}
+
+std::vector<uint32_t> IdDictionary::sortedIds() const {
+    std::vector<uint32_t> ids(mNames.size());
+    for (uint32_t id = 0; id < ids.size(); id++) {
+        ids[id] = id;
+    }
+    std::sort(ids.begin(), ids.end(), NameLess(this));
+    return ids;
+}
+
+void IdDictionary::swap(IdDictionary& other) {
+    mNames.swap(other.mNames);
+    mSlots.swap(other.mSlots);
+}
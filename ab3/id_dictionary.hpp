@@ -0,0 +1,33 @@
+#ifndef ID_DICTIONARY_HPP
+#define ID_DICTIONARY_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+/*
+ * Interns node names: every distinct name gets a dense uint32_t id,
+ * handed out in order of first appearance.  Lookups go through an
+ * open-addressing hash table of ids, so they cost one hash and usually
+ * one string comparison.
+ */
+class IdDictionary {
+private:
+    std::vector<std::string> mNames;
+    std::vector<uint32_t> mSlots;
+    size_t slotOf(const char*, size_t, uint32_t) const;
+    void grow();
+public:
+    IdDictionary();
+    uint32_t intern(const std::string&);
+    uint32_t intern(const char*, size_t, uint32_t);
+    bool find(const std::string&, uint32_t&) const;
+    const std::string& getName(uint32_t) const;
+    uint32_t size() const;
+    std::vector<uint32_t> sortedIds() const;
+    void swap(IdDictionary&);
+};
+
+uint32_t hashName(const char*, size_t);
+
+#endif
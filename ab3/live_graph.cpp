@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <sys/time.h>
+#include "live_graph.hpp"
+#include "utils.hpp"
+
+namespace {
+
+uint64_t micros() {
+    timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec * 1000000ULL + time.tv_usec;
+}
+
+}
+
+LiveGraph::LiveGraph(CsrGraph* graph) : mBase(graph), mCompacted(graph), mCurrent(graph), mLinks(0), mInvalid(0), mSnapshots(0), mCompactions(0), mLastPublishMicros(0), mMaxPublishMicros(0), mTotalPublishMicros(0), mTotalGraceMicros(0), mLastListenerMicros(0), mMaxListenerMicros(0), mTotalListenerMicros(0), mRunning(false), mIntervalMillis(0) {
+    pthread_mutex_init(&mWriteLock, NULL);
+    pthread_mutex_init(&mPublishLock, NULL);
+    pthread_mutex_init(&mRetainLock, NULL);
+    pthread_mutex_init(&mStopLock, NULL);
+    pthread_cond_init(&mStopped, NULL);
+}
+
+LiveGraph::~LiveGraph() {
+    stop();
+    if (mCurrent != mCompacted) {
+        delete mCurrent;
+    }
+    release(mCompacted);
+    pthread_cond_destroy(&mStopped);
+    pthread_mutex_destroy(&mStopLock);
+    pthread_mutex_destroy(&mRetainLock);
+    pthread_mutex_destroy(&mPublishLock);
+    pthread_mutex_destroy(&mWriteLock);
+}
+
+unsigned int LiveGraph::enter() {
+    return mReaders.enter();
+}
+
+// Only valid between enter() and leave().
+CsrGraph* LiveGraph::current() {
+    return __atomic_load_n(&mCurrent, __ATOMIC_SEQ_CST);
+}
+
+void LiveGraph::leave(unsigned int slot) {
+    mReaders.leave(slot);
+}
+
+void LiveGraph::addLink(const std::string& one, const std::string& two, uint32_t weight) {
+    CsrLink link;
+    link.mOne = one;
+    link.mTwo = two;
+    link.mWeight = weight;
+    pthread_mutex_lock(&mWriteLock);
+    mPending.push_back(link);
+    mLinks++;
+    pthread_mutex_unlock(&mWriteLock);
+}
+
+// Queues the links of a buffer of lines in the format read by
+// populateGraph(), and returns how many were valid.  Invalid lines are
+// only counted.
+size_t LiveGraph::addLinks(const char* data, size_t size) {
+    std::vector<CsrLink> links;
+    size_t invalid = 0;
+    const char* end = data + size;
+    for (const char* begin = data; begin < end;) {
+        const char* newline = begin;
+        while (newline < end && *newline != '\n') {
+            newline++;
+        }
+        const char* last = newline;
+        if (last > begin && last[-1] == '\r') {
+            last--;
+        }
+        if (last > begin) {
+            std::vector<std::string> tokens = tokenize(std::string(begin, last), " ");
+            if (tokens.size() < 3 || tokens.at(1) != "=>") {
+                invalid++;
+            } else {
+                CsrLink link;
+                link.mOne = tokens.at(0);
+                link.mTwo = tokens.at(2);
+                link.mWeight = tokens.size() > 3 ? parse_weight(tokens.at(3).data(), tokens.at(3).size()) : 1;
+                links.push_back(link);
+            }
+        }
+        begin = newline + 1;
+    }
+
+    pthread_mutex_lock(&mWriteLock);
+    mPending.insert(mPending.end(), links.begin(), links.end());
+    mLinks += links.size();
+    mInvalid += invalid;
+    pthread_mutex_unlock(&mWriteLock);
+    return links.size();
+}
+
+// Adds the queued links to a new snapshot and swaps it in.  Links
+// queued meanwhile wait for the next publish.  Returns false if there
+// was nothing to publish.
+bool LiveGraph::publish() {
+    pthread_mutex_lock(&mPublishLock);
+    std::vector<CsrLink> links;
+    pthread_mutex_lock(&mWriteLock);
+    links.swap(mPending);
+    pthread_mutex_unlock(&mWriteLock);
+    if (links.empty()) {
+        pthread_mutex_unlock(&mPublishLock);
+        return false;
+    }
+
+    uint64_t start = micros();
+    CsrGraph* old = mCurrent;
+    CsrGraph* oldCompacted = mCompacted;
+    mDelta.insert(mDelta.end(), links.begin(), links.end());
+    CsrGraph* next;
+    if (mDelta.size() * compactRatio >= mCompacted->getEdges()) {
+        next = new CsrGraph(mCompacted, mDelta);
+        pthread_mutex_lock(&mRetainLock);
+        mRetained[next] = 1;
+        pthread_mutex_unlock(&mRetainLock);
+        mCompacted = next;
+        mDelta.clear();
+        mCompactions++;
+    } else {
+        next = CsrGraph::overlay(mCompacted, mDelta);
+    }
+    __atomic_store_n(&mCurrent, next, __ATOMIC_SEQ_CST);
+    uint64_t epoch = mReaders.advance();
+    uint64_t published = micros();
+    mReaders.synchronize(epoch);
+    if (old != oldCompacted) {
+        delete old;
+    }
+    if (oldCompacted != mCompacted) {
+        release(oldCompacted);
+    }
+    uint64_t notified = micros();
+    mTotalGraceMicros += notified - published;
+    for (size_t i = 0; i < mListeners.size(); i++) {
+        mListeners[i]->snapshotPublished(this, next, links);
+    }
+
+    mSnapshots++;
+    mLastPublishMicros = published - start;
+    mMaxPublishMicros = std::max(mMaxPublishMicros, mLastPublishMicros);
+    mTotalPublishMicros += mLastPublishMicros;
+    mLastListenerMicros = micros() - notified;
+    mMaxListenerMicros = std::max(mMaxListenerMicros, mLastListenerMicros);
+    mTotalListenerMicros += mLastListenerMicros;
+    pthread_mutex_unlock(&mPublishLock);
+    return true;
+}
+
+void* LiveGraph::publishThread(void* arg) {
+    LiveGraph* live = static_cast<LiveGraph*>(arg);
+    pthread_mutex_lock(&live->mStopLock);
+    while (live->mRunning) {
+        uint64_t deadline = micros() + live->mIntervalMillis * 1000ULL;
+        timespec until;
+        until.tv_sec = deadline / 1000000;
+        until.tv_nsec = deadline % 1000000 * 1000;
+        pthread_cond_timedwait(&live->mStopped, &live->mStopLock, &until);
+        if (live->mRunning) {
+            pthread_mutex_unlock(&live->mStopLock);
+            live->publish();
+            pthread_mutex_lock(&live->mStopLock);
+        }
+    }
+    pthread_mutex_unlock(&live->mStopLock);
+    return NULL;
+}
+
+// Publishes queued links every interval from a background thread.
+void LiveGraph::start(unsigned int intervalMillis) {
+    pthread_mutex_lock(&mStopLock);
+    if (!mRunning) {
+        mRunning = true;
+        mIntervalMillis = intervalMillis ? intervalMillis : 1;
+        pthread_create(&mPublisher, NULL, publishThread, this);
+    }
+    pthread_mutex_unlock(&mStopLock);
+}
+
+void LiveGraph::stop() {
+    pthread_mutex_lock(&mStopLock);
+    bool running = mRunning;
+    mRunning = false;
+    pthread_cond_signal(&mStopped);
+    pthread_mutex_unlock(&mStopLock);
+    if (running) {
+        pthread_join(mPublisher, NULL);
+    }
+}
+
+void LiveGraph::addSnapshotListener(SnapshotListener* listener) {
+    pthread_mutex_lock(&mPublishLock);
+    mListeners.push_back(listener);
+    pthread_mutex_unlock(&mPublishLock);
+}
+
+// Keeps a compacted snapshot from being deleted when a compaction
+// replaces it, until it is released as often as it was retained.  Only
+// valid for the snapshot a listener is being told about, or one still
+// retained; the graph given to the constructor is never deleted anyway.
+void LiveGraph::retain(CsrGraph* graph) {
+    pthread_mutex_lock(&mRetainLock);
+    std::map<CsrGraph*, unsigned int>::iterator retained = mRetained.find(graph);
+    if (retained != mRetained.end()) {
+        retained->second++;
+    }
+    pthread_mutex_unlock(&mRetainLock);
+}
+
+void LiveGraph::release(CsrGraph* graph) {
+    pthread_mutex_lock(&mRetainLock);
+    std::map<CsrGraph*, unsigned int>::iterator retained = mRetained.find(graph);
+    bool last = retained != mRetained.end() && --retained->second == 0;
+    if (last) {
+        mRetained.erase(retained);
+    }
+    pthread_mutex_unlock(&mRetainLock);
+    if (last) {
+        delete graph;
+    }
+}
+
+LiveGraphStats LiveGraph::getStats() {
+    LiveGraphStats stats = LiveGraphStats();
+    pthread_mutex_lock(&mWriteLock);
+    stats.mLinks = mLinks;
+    stats.mInvalid = mInvalid;
+    stats.mPending = mPending.size();
+    pthread_mutex_unlock(&mWriteLock);
+    pthread_mutex_lock(&mPublishLock);
+    stats.mSnapshots = mSnapshots;
+    stats.mCompactions = mCompactions;
+    stats.mOverlayLinks = mDelta.size();
+    stats.mNodes = mCurrent->size();
+    stats.mEdges = mCurrent->getEdges();
+    stats.mLastPublishMicros = mLastPublishMicros;
+    stats.mMaxPublishMicros = mMaxPublishMicros;
+    stats.mTotalPublishMicros = mTotalPublishMicros;
+    stats.mTotalGraceMicros = mTotalGraceMicros;
+    stats.mLastListenerMicros = mLastListenerMicros;
+    stats.mMaxListenerMicros = mMaxListenerMicros;
+    stats.mTotalListenerMicros = mTotalListenerMicros;
+    pthread_mutex_unlock(&mPublishLock);
+    return stats;
+}
@@ -0,0 +1,143 @@
+#ifndef LIVE_GRAPH_HPP
+#define LIVE_GRAPH_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include "csr_graph.hpp"
+#include "reader_epochs.hpp"
+
+class LiveGraph;
+
+/*
+ * Told about the links of every snapshot a LiveGraph publishes, once
+ * no reader can see the snapshot it replaced any more.
+ */
+class SnapshotListener {
+public:
+    virtual ~SnapshotListener() {}
+    virtual void snapshotPublished(LiveGraph*, CsrGraph*, const std::vector<CsrLink>&) = 0;
+};
+
+struct LiveGraphStats {
+    uint64_t mLinks;
+    uint64_t mInvalid;
+    uint64_t mPending;
+    uint64_t mSnapshots;
+    uint64_t mCompactions;
+    uint64_t mOverlayLinks;
+    uint64_t mNodes;
+    uint64_t mEdges;
+    uint64_t mLastPublishMicros;
+    uint64_t mMaxPublishMicros;
+    uint64_t mTotalPublishMicros;
+    uint64_t mTotalGraceMicros;
+    uint64_t mLastListenerMicros;
+    uint64_t mMaxListenerMicros;
+    uint64_t mTotalListenerMicros;
+};
+
+/*
+ * A CsrGraph that takes new links while it is being read.  Links are
+ * queued on the write side and published as a new snapshot by
+ * publish(), which a background thread calls every so often.  The new
+ * snapshot replaces the old one with a single pointer store, so readers
+ * take no lock on the graph.
+ *
+ * Instead, a reader holds a ReaderEpochs slot while it uses a snapshot.
+ * Each publish starts a new epoch and waits until no slot is left from
+ * an older one before deleting the replaced snapshot and telling the
+ * listeners.  Results
+ * computed from an old snapshot are therefore always finished by the
+ * time caches drop them.  The graph given to the constructor stays
+ * owned by the caller and is never deleted.
+ *
+ * Snapshots are overlays holding every link published since the last
+ * compacted graph, so a publish costs time in those links rather than
+ * in the whole graph.  Once they add up to a 1/compactRatio share of
+ * its edges, they are merged into a new compacted graph instead.
+ * A listener that wants to keep using a compacted snapshot after the
+ * next compaction retains it, and releases it before the LiveGraph is
+ * deleted.
+ */
+class LiveGraph {
+private:
+    static const uint64_t compactRatio = 64;
+
+    CsrGraph* mBase;
+    CsrGraph* mCompacted;
+    CsrGraph* mCurrent;
+    ReaderEpochs mReaders;
+
+    pthread_mutex_t mWriteLock;
+    std::vector<CsrLink> mPending;
+    uint64_t mLinks;
+    uint64_t mInvalid;
+
+    pthread_mutex_t mPublishLock;
+    std::vector<SnapshotListener*> mListeners;
+    std::vector<CsrLink> mDelta;
+    uint64_t mSnapshots;
+    uint64_t mCompactions;
+    uint64_t mLastPublishMicros;
+    uint64_t mMaxPublishMicros;
+    uint64_t mTotalPublishMicros;
+    uint64_t mTotalGraceMicros;
+    uint64_t mLastListenerMicros;
+    uint64_t mMaxListenerMicros;
+    uint64_t mTotalListenerMicros;
+
+    pthread_mutex_t mRetainLock;
+    std::map<CsrGraph*, unsigned int> mRetained;
+
+    pthread_t mPublisher;
+    pthread_mutex_t mStopLock;
+    pthread_cond_t mStopped;
+    bool mRunning;
+    unsigned int mIntervalMillis;
+
+    LiveGraph(const LiveGraph&);
+    LiveGraph& operator=(const LiveGraph&);
+    static void* publishThread(void*);
+public:
+    LiveGraph(CsrGraph*);
+    ~LiveGraph();
+    unsigned int enter();
+    CsrGraph* current();
+    void leave(unsigned int);
+    void addLink(const std::string&, const std::string&, uint32_t);
+    size_t addLinks(const char*, size_t);
+    bool publish();
+    void start(unsigned int);
+    void stop();
+    void addSnapshotListener(SnapshotListener*);
+    void retain(CsrGraph*);
+    void release(CsrGraph*);
+    LiveGraphStats getStats();
+};
+
+/*
+ * Holds a reader slot of a LiveGraph for as long as it lives; the
+ * snapshot it returns stays valid until then.
+ */
+class SnapshotGuard {
+private:
+    LiveGraph* mLive;
+    unsigned int mSlot;
+    CsrGraph* mGraph;
+
+    SnapshotGuard(const SnapshotGuard&);
+    SnapshotGuard& operator=(const SnapshotGuard&);
+public:
+    SnapshotGuard(LiveGraph* live) : mLive(live), mSlot(live->enter()), mGraph(live->current()) {}
+    ~SnapshotGuard() {
+        mLive->leave(mSlot);
+    }
+    CsrGraph* get() {
+        return mGraph;
+    }
+};
+
+#endif
@@ -0,0 +1,367 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loader.hpp"
+#include "utils.hpp"
+
+namespace {
+
+/*
+ * Temporary ids carry their shard in the low bits and the id within
+ * the shard above them, until everything is renumbered in name order.
+ */
+const unsigned int shardBits = 6;
+const unsigned int shardCount = 1 << shardBits;
+const size_t chunkSize = 1 << 22;
+const uint32_t mergeBlock = 1024;
+
+struct Token {
+    const char* mData;
+    size_t mSize;
+};
+
+struct Chunk {
+    const char* mBegin;
+    const char* mEnd;
+};
+
+struct Mapping {
+    void* mData;
+    size_t mSize;
+};
+
+struct Shard {
+    pthread_mutex_t mLock;
+    IdDictionary mIds;
+    std::vector<uint32_t> mOrder;
+    std::vector<uint32_t> mRemap;
+};
+
+struct Edge {
+    uint32_t mOne;
+    uint32_t mTwo;
+    uint32_t mWeight;
+};
+
+typedef std::vector<Edge> EdgeList;
+
+class Loader;
+
+struct Worker {
+    Loader* mLoader;
+    void (Loader::*mPhase)(unsigned int);
+    unsigned int mIndex;
+};
+
+void* runWorker(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    (worker->mLoader->*worker->mPhase)(worker->mIndex);
+    return NULL;
+}
+
+// Splits the line at spaces like tokenize() does, stopping after the
+// first four tokens.  Returns the number of tokens found.
+size_t splitLine(const char* begin, const char* end, Token* tokens) {
+    size_t count = 0;
+    const char* position = begin;
+    while (count < 4) {
+        while (position < end && *position == ' ') {
+            position++;
+        }
+        if (position == end) {
+            break;
+        }
+        const char* start = position;
+        while (position < end && *position != ' ') {
+            position++;
+        }
+        tokens[count].mData = start;
+        tokens[count].mSize = position - start;
+        count++;
+    }
+    return count;
+}
+
+class Loader {
+private:
+    unsigned int mThreads;
+    std::vector<Mapping> mMappings;
+    std::vector<Chunk> mChunks;
+    size_t mNextChunk;
+    uint32_t mNextNode;
+    pthread_mutex_t mErrorLock;
+    Shard mShards[shardCount];
+    std::vector<EdgeList> mEdges;
+    std::vector<uint64_t> mOffsets;
+    std::vector<uint64_t> mCursors;
+    std::vector<uint32_t> mNeighbors;
+    std::vector<uint32_t> mWeights;
+    std::vector<uint64_t> mUnique;
+    IdDictionary mIds;
+
+    class HeadGreater {
+    private:
+        Loader* mLoader;
+        std::vector<size_t>* mHeads;
+        const std::string& head(uint32_t s) const {
+            Shard& shard = mLoader->mShards[s];
+            return shard.mIds.getName(shard.mOrder[mHeads->at(s)]);
+        }
+    public:
+        HeadGreater(Loader* loader, std::vector<size_t>* heads) : mLoader(loader), mHeads(heads) {}
+        bool operator()(uint32_t a, uint32_t b) const {
+            return head(b) < head(a);
+        }
+    };
+
+    uint32_t intern(const Token& token) {
+        uint32_t hash = hashName(token.mData, token.mSize);
+        uint32_t shard = hash >> (32 - shardBits);
+        pthread_mutex_lock(&mShards[shard].mLock);
+        uint32_t id = mShards[shard].mIds.intern(token.mData, token.mSize, hash);
+        pthread_mutex_unlock(&mShards[shard].mLock);
+        return (id << shardBits) | shard;
+    }
+
+    uint32_t finalId(uint32_t id) {
+        return mShards[id & (shardCount - 1)].mRemap[id >> shardBits];
+    }
+
+    void parseLine(const char* begin, const char* end, EdgeList& edges) {
+        Token tokens[4];
+        size_t count = splitLine(begin, end, tokens);
+        if (count < 3 || tokens[1].mSize != 2 || memcmp(tokens[1].mData, "=>", 2) != 0) {
+            pthread_mutex_lock(&mErrorLock);
+            std::cerr << "Invalid format: '" << std::string(begin, end) << "'" << std::endl;
+            pthread_mutex_unlock(&mErrorLock);
+            return;
+        }
+        Edge edge;
+        edge.mOne = intern(tokens[0]);
+        edge.mTwo = intern(tokens[2]);
+        edge.mWeight = count > 3 ? parse_weight(tokens[3].mData, tokens[3].mSize) : 1;
+        edges.push_back(edge);
+    }
+
+    void run(void (Loader::*phase)(unsigned int)) {
+        std::vector<pthread_t> threads(mThreads);
+        std::vector<Worker> workers(mThreads);
+        for (unsigned int i = 0; i < mThreads; i++) {
+            workers[i].mLoader = this;
+            workers[i].mPhase = phase;
+            workers[i].mIndex = i;
+            pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+        }
+        for (unsigned int i = 0; i < mThreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    void map(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            std::cerr << "Could not open input file." << std::endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+
+        Mapping mapping;
+        mapping.mSize = info.st_size;
+        mapping.mData = mapping.mSize ? mmap(NULL, mapping.mSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (mapping.mData == MAP_FAILED) {
+            return;
+        }
+        madvise(mapping.mData, mapping.mSize, MADV_SEQUENTIAL);
+        mMappings.push_back(mapping);
+
+        const char* data = static_cast<const char*>(mapping.mData);
+        const char* end = data + mapping.mSize;
+        while (data < end) {
+            Chunk chunk;
+            chunk.mBegin = data;
+            chunk.mEnd = data + std::min(chunkSize, (size_t) (end - data));
+            while (chunk.mEnd < end && chunk.mEnd[-1] != '\n') {
+                chunk.mEnd++;
+            }
+            mChunks.push_back(chunk);
+            data = chunk.mEnd;
+        }
+    }
+
+    void parse(unsigned int thread) {
+        EdgeList& edges = mEdges[thread];
+        size_t index;
+        while ((index = __sync_fetch_and_add(&mNextChunk, 1)) < mChunks.size()) {
+            const char* line = mChunks[index].mBegin;
+            const char* end = mChunks[index].mEnd;
+            while (line < end) {
+                const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+                if (!newline) {
+                    newline = end;
+                }
+                if (newline > line) {
+                    parseLine(line, newline, edges);
+                }
+                line = newline + 1;
+            }
+        }
+    }
+
+    void sortShards(unsigned int thread) {
+        for (unsigned int s = thread; s < shardCount; s += mThreads) {
+            mShards[s].mOrder = mShards[s].mIds.sortedIds();
+            mShards[s].mRemap.resize(mShards[s].mOrder.size());
+        }
+    }
+
+    // Merges the sorted shards, so that final ids follow name order.
+    void renumber() {
+        std::vector<size_t> heads(shardCount, 0);
+        std::vector<uint32_t> heap;
+        for (unsigned int s = 0; s < shardCount; s++) {
+            if (!mShards[s].mOrder.empty()) {
+                heap.push_back(s);
+            }
+        }
+        HeadGreater greater(this, &heads);
+        std::make_heap(heap.begin(), heap.end(), greater);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            Shard& shard = mShards[heap.back()];
+            uint32_t id = shard.mOrder[heads[heap.back()]];
+            shard.mRemap[id] = mIds.intern(shard.mIds.getName(id));
+            if (++heads[heap.back()] < shard.mOrder.size()) {
+                std::push_heap(heap.begin(), heap.end(), greater);
+            } else {
+                heap.pop_back();
+            }
+        }
+    }
+
+    void countDegrees(unsigned int thread) {
+        EdgeList& edges = mEdges[thread];
+        for (size_t i = 0; i < edges.size(); i++) {
+            edges[i].mOne = finalId(edges[i].mOne);
+            edges[i].mTwo = finalId(edges[i].mTwo);
+            __sync_fetch_and_add(&mOffsets[edges[i].mOne + 1], 1);
+            __sync_fetch_and_add(&mOffsets[edges[i].mTwo + 1], 1);
+        }
+    }
+
+    void scatter(unsigned int thread) {
+        EdgeList& edges = mEdges[thread];
+        for (size_t i = 0; i < edges.size(); i++) {
+            uint64_t slot = __sync_fetch_and_add(&mCursors[edges[i].mOne], 1);
+            mNeighbors[slot] = edges[i].mTwo;
+            mWeights[slot] = edges[i].mWeight;
+            slot = __sync_fetch_and_add(&mCursors[edges[i].mTwo], 1);
+            mNeighbors[slot] = edges[i].mOne;
+            mWeights[slot] = edges[i].mWeight;
+        }
+        EdgeList().swap(edges);
+    }
+
+    // Sorts the list of every node and merges repeated neighbors,
+    // adding up their weights.  The unique entries end up at the start
+    // of the list and their number in mUnique.
+    void merge(unsigned int) {
+        std::vector<std::pair<uint32_t, uint32_t> > links;
+        uint32_t block;
+        while ((block = __sync_fetch_and_add(&mNextNode, mergeBlock)) < mIds.size()) {
+            for (uint32_t node = block; node < mIds.size() && node < block + mergeBlock; node++) {
+                links.clear();
+                for (uint64_t i = mOffsets[node]; i < mOffsets[node + 1]; i++) {
+                    links.push_back(std::make_pair(mNeighbors[i], mWeights[i]));
+                }
+                std::sort(links.begin(), links.end());
+                uint64_t unique = mOffsets[node];
+                for (size_t i = 0; i < links.size(); i++) {
+                    if (i > 0 && links[i].first == links[i - 1].first) {
+                        mWeights[unique - 1] = add_weight(mWeights[unique - 1], links[i].second);
+                    } else {
+                        mNeighbors[unique] = links[i].first;
+                        mWeights[unique] = links[i].second;
+                        unique++;
+                    }
+                }
+                mUnique[node] = unique - mOffsets[node];
+            }
+        }
+    }
+
+    // Closes the gaps left by merge(), moving every list down to its
+    // final offset.
+    void compact() {
+        uint64_t end = 0;
+        for (uint32_t node = 0; node < mIds.size(); node++) {
+            uint64_t begin = mOffsets[node];
+            mOffsets[node] = end;
+            for (uint64_t i = 0; i < mUnique[node]; i++) {
+                mNeighbors[end + i] = mNeighbors[begin + i];
+                mWeights[end + i] = mWeights[begin + i];
+            }
+            end += mUnique[node];
+        }
+        mOffsets[mIds.size()] = end;
+        mNeighbors.resize(end);
+        mWeights.resize(end);
+    }
+
+public:
+    Loader(unsigned int threads) : mThreads(threads ? threads : 1), mNextChunk(0), mNextNode(0), mEdges(mThreads) {
+        pthread_mutex_init(&mErrorLock, NULL);
+        for (unsigned int s = 0; s < shardCount; s++) {
+            pthread_mutex_init(&mShards[s].mLock, NULL);
+        }
+    }
+
+    ~Loader() {
+        for (size_t i = 0; i < mMappings.size(); i++) {
+            munmap(mMappings[i].mData, mMappings[i].mSize);
+        }
+        for (unsigned int s = 0; s < shardCount; s++) {
+            pthread_mutex_destroy(&mShards[s].mLock);
+        }
+        pthread_mutex_destroy(&mErrorLock);
+    }
+
+    CsrGraph* load(const std::vector<std::string>& filenames) {
+        for (size_t i = 0; i < filenames.size(); i++) {
+            map(filenames[i]);
+        }
+        run(&Loader::parse);
+        run(&Loader::sortShards);
+        renumber();
+
+        mOffsets.assign(mIds.size() + 1, 0);
+        run(&Loader::countDegrees);
+        for (size_t i = 1; i < mOffsets.size(); i++) {
+            mOffsets[i] += mOffsets[i - 1];
+        }
+        mCursors.assign(mOffsets.begin(), mOffsets.end() - 1);
+        mNeighbors.resize(mOffsets.back());
+        mWeights.resize(mOffsets.back());
+        run(&Loader::scatter);
+
+        mUnique.resize(mIds.size());
+        run(&Loader::merge);
+        compact();
+        return new CsrGraph(mIds, mOffsets, mNeighbors, mWeights);
+    }
+};
+
+}
+
+CsrGraph* loadGraph(const std::vector<std::string>& filenames, unsigned int threads) {
+    Loader loader(threads);
+    return loader.load(filenames);
+}
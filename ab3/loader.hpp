@@ -0,0 +1,19 @@
+#ifndef LOADER_HPP
+#define LOADER_HPP
+
+#include <vector>
+#include <string>
+#include "csr_graph.hpp"
+
+/*
+ * Builds a CsrGraph straight from edge files in the format read by
+ * populateGraph(), without going through a Graph.  The files are
+ * memory-mapped and cut into chunks at line boundaries, which the given
+ * number of threads parse in place.  Names are interned into a sharded
+ * dictionary and edges collected per thread, then renumbered in name
+ * order and scattered into the CSR arrays.  Repeated links are merged
+ * at the end by sorting each node's list once.
+ */
+CsrGraph* loadGraph(const std::vector<std::string>&, unsigned int);
+
+#endif
@@ -6,67 +6,267 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
 #include "utils.hpp"
 #include "node.hpp"
 #include "graph.hpp"
+#include "csr_graph.hpp"
+#include "loader.hpp"
+#include "recommend.hpp"
+#include "recommend_cache.hpp"
+#include "cooccurrence_index.hpp"
+#include "live_graph.hpp"
 #include "mongoose.h"
 
-bool sortPairs(std::pair<std::string, unsigned int> a, std::pair<std::string, unsigned int> b) {
-    if (a.second == b.second) {
-        return a.first > b.first;
-    } else {
-        return a.second > b.second;
+static CsrGraph* graph;
+static LiveGraph* live;
+static RecommendCache* cache;
+static CooccurrenceIndex* cooccurrence;
+static unsigned int cores;
+
+static const size_t maxLinksBody = 64 << 20;
+
+// The recommendations served for a track: the other score modes go
+// straight to recommend(), the default one to the index or else the
+// cache.
+static std::vector<std::pair<std::string, uint64_t> > similar_tracks(CsrGraph* snapshot, const std::string& trackId, size_t limit, ScoreMode mode) {
+    std::vector<std::pair<std::string, uint64_t> > scoreList;
+    if (mode != SCORE_MULTIPLICITY) {
+        scoreList = recommend(snapshot, trackId, limit, mode);
+    } else if (!cooccurrence || !cooccurrence->lookup(trackId, limit, scoreList)) {
+        scoreList = cache->recommend(snapshot, trackId, limit);
     }
+    return scoreList;
 }
 
-std::vector<std::pair<std::string, unsigned short> > recommend(Graph* g, std::string nodeId) {
-    Node* node = g->getNode(nodeId);
-    std::vector<std::pair<std::string, unsigned short > > scoreList;
-    if (!node) {
-        return scoreList;
-    }
-
-    std::map<std::string, unsigned short> counts;
-    std::vector<Node*>* charts = node->getNeighbors();
-    std::vector<Node*>* tracks;
-    std::map<std::string, unsigned short>::const_iterator countsIt;
-    std::string relatedId;
-    for (size_t i = 0; i < charts->size(); i++) {
-        tracks = charts->at(i)->getNeighbors();
-        for (size_t j = 0; j < tracks->size(); j++) {
-            relatedId = tracks->at(j)->getId();
-            if (relatedId == nodeId) {
-                continue;
-            }
-            ++counts[relatedId];
+// The limit parameter of a request, clamped to the number of tracks in
+// the snapshot, so that no request asks for more recommendations than
+// there can be.
+static size_t parse_limit(const std::vector<std::pair<std::string, std::string> >& params, CsrGraph* snapshot) {
+    long limit = strtol(get_param_value(params, "limit", "24").c_str(), NULL, 10);
+    return limit < 0 ? 0 : std::min<size_t>(limit, snapshot->size());
+}
+
+// Sends the status line, headers and body with a single write.  The
+// Content-Length lets the client keep the connection alive.
+static void send_response(mg_connection* conn, const char* contentType, const std::string& body) {
+    std::string response;
+    response.reserve(body.size() + 128);
+    response += "HTTP/1.1 200 OK\r\nContent-Type: ";
+    response += contentType;
+    response += "\r\nContent-Length: ";
+    append_number(response, body.size());
+    response += "\r\n\r\n";
+    response += body;
+    mg_write(conn, response.data(), response.size());
+}
+
+void* handle_similar_tracks_action(mg_event event, mg_connection* conn, const mg_request_info* request) {
+    if (event == MG_NEW_REQUEST) {
+        std::vector<std::pair<std::string, std::string> > params = parse_qs(request->query_string);
+        std::string trackId = std::string("track-") + get_param_value(params, "trackId", "0");
+        ScoreMode mode = SCORE_MULTIPLICITY;
+        parseScoreMode(get_param_value(params, "mode", "multiplicity"), mode);
+        SnapshotGuard guard(live);
+        size_t limit = parse_limit(params, guard.get());
+        std::vector<std::pair<std::string, uint64_t> > scoreList = similar_tracks(guard.get(), trackId, limit, mode);
+        std::string body;
+        body.reserve(scoreList.size() * 128);
+        for (size_t i = 0; i < scoreList.size(); i++) {
+            const std::string& name = scoreList[i].first;
+            body += name;
+            body += ',';
+            append_number(body, scoreList[i].second);
+            body += " &nbsp;&nbsp;<a href=\"http://www.beatport.com/track/_/";
+            body += second_token(name, '-');
+            body += "\">=></a><br/>\n";
         }
+        send_response(conn, "text/html", body);
+        return const_cast<char*>("");
+    } else {
+        return NULL;
     }
+}
+
+/*
+ * One request of a batch.  Threads claim tracks through next and fill in
+ * their score lists, all from the same snapshot.  finished and workers
+ * are guarded by batchLock.
+ */
+struct BatchJob {
+    CsrGraph* mGraph;
+    std::vector<std::string> mTrackIds;
+    std::vector<std::vector<std::pair<std::string, uint64_t> > > mScoreLists;
+    size_t mLimit;
+    ScoreMode mMode;
+    size_t mNext;
+    size_t mFinished;
+    unsigned int mWorkers;
+};
+
+// Batches waiting for help from the workers, which are started once and
+// shared by all requests, so that their score counters are reused.
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batchQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batchFinished = PTHREAD_COND_INITIALIZER;
+static std::list<BatchJob*> batchQueue;
+static std::vector<pthread_t> batchWorkers;
+static bool batchStopping;
 
-    countsIt = counts.begin();
-    while (countsIt != counts.end()) {
-        scoreList.push_back(std::make_pair(countsIt->first, countsIt->second));
-        ++countsIt;
+// Answers tracks of the job until none are left, and returns how many.
+static size_t run_batch(BatchJob* job) {
+    size_t done = 0;
+    size_t i;
+    while ((i = __sync_fetch_and_add(&job->mNext, 1)) < job->mTrackIds.size()) {
+        job->mScoreLists[i] = similar_tracks(job->mGraph, std::string("track-") + job->mTrackIds[i], job->mLimit, job->mMode);
+        done++;
     }
+    return done;
+}
 
-    std::sort(scoreList.begin(), scoreList.end(), sortPairs);
+// Helps with the oldest queued batch until the workers are stopped.
+// Batches with no tracks left to claim are dropped from the queue; the
+// request thread waits for the ones still running.
+static void* batch_worker(void*) {
+    pthread_mutex_lock(&batchLock);
+    while (!batchStopping) {
+        if (batchQueue.empty()) {
+            pthread_cond_wait(&batchQueued, &batchLock);
+            continue;
+        }
+        BatchJob* job = batchQueue.front();
+        if (__atomic_load_n(&job->mNext, __ATOMIC_SEQ_CST) >= job->mTrackIds.size()) {
+            batchQueue.pop_front();
+            continue;
+        }
+        job->mWorkers++;
+        pthread_mutex_unlock(&batchLock);
+        size_t done = run_batch(job);
+        pthread_mutex_lock(&batchLock);
+        job->mFinished += done;
+        if (--job->mWorkers == 0 && job->mFinished == job->mTrackIds.size()) {
+            pthread_cond_broadcast(&batchFinished);
+        }
+    }
+    pthread_mutex_unlock(&batchLock);
+    return NULL;
+}
 
-    return scoreList;
+// Starts up to count workers.  Batches still get answered by the request
+// thread alone if none could be started.
+static void start_batch_workers(unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, batch_worker, NULL) != 0) {
+            std::cerr << "Could not start batch worker " << i << " of " << count << std::endl;
+            break;
+        }
+        batchWorkers.push_back(worker);
+    }
 }
 
-static Graph* graph;
+static void stop_batch_workers() {
+    pthread_mutex_lock(&batchLock);
+    batchStopping = true;
+    pthread_cond_broadcast(&batchQueued);
+    pthread_mutex_unlock(&batchLock);
+    for (size_t i = 0; i < batchWorkers.size(); i++) {
+        pthread_join(batchWorkers[i], NULL);
+    }
+    batchWorkers.clear();
+}
 
-void* handle_similar_tracks_action(mg_event event, mg_connection* conn, const mg_request_info* request) {
+// Answers {"1":[["2",5],["3",4]],"7":[]} for trackId=1&trackId=7 or
+// trackIds=1,7, with the track- prefix left out of all ids.  The request
+// thread works through the tracks itself, helped by whichever batch
+// workers are free.
+void* handle_similar_tracks_batch_action(mg_event event, mg_connection* conn, const mg_request_info* request) {
     if (event == MG_NEW_REQUEST) {
         std::vector<std::pair<std::string, std::string> > params = parse_qs(request->query_string);
-        std::string trackId = std::string("track-") + get_param_value(params, "trackId", "0");
-        size_t limit = atoi(get_param_value(params, "limit", "24").c_str());
-        std::vector<std::pair<std::string, unsigned short> > scoreList = recommend(graph, trackId);
-        std::string linkTrackId;
+        BatchJob job;
+        for (size_t i = 0; i < params.size(); i++) {
+            if (params[i].first == "trackId") {
+                job.mTrackIds.push_back(params[i].second);
+            } else if (params[i].first == "trackIds") {
+                std::vector<std::string> ids = tokenize(params[i].second, ",");
+                job.mTrackIds.insert(job.mTrackIds.end(), ids.begin(), ids.end());
+            }
+        }
+        job.mScoreLists.resize(job.mTrackIds.size());
+        job.mMode = SCORE_MULTIPLICITY;
+        parseScoreMode(get_param_value(params, "mode", "multiplicity"), job.mMode);
+        job.mNext = 0;
+        job.mFinished = 0;
+        job.mWorkers = 0;
+
+        SnapshotGuard guard(live);
+        job.mGraph = guard.get();
+        job.mLimit = parse_limit(params, job.mGraph);
+        bool shared = job.mTrackIds.size() > 1 && !batchWorkers.empty();
+        if (shared) {
+            pthread_mutex_lock(&batchLock);
+            batchQueue.push_back(&job);
+            pthread_cond_broadcast(&batchQueued);
+            pthread_mutex_unlock(&batchLock);
+        }
+        size_t done = run_batch(&job);
+        if (shared) {
+            pthread_mutex_lock(&batchLock);
+            job.mFinished += done;
+            while (job.mFinished < job.mTrackIds.size() || job.mWorkers > 0) {
+                pthread_cond_wait(&batchFinished, &batchLock);
+            }
+            batchQueue.remove(&job);
+            pthread_mutex_unlock(&batchLock);
+        }
+
+        size_t size = 2;
+        for (size_t i = 0; i < job.mTrackIds.size(); i++) {
+            size += job.mTrackIds[i].size() + 6;
+            for (size_t j = 0; j < job.mScoreLists[i].size(); j++) {
+                size += job.mScoreLists[i][j].first.size() + 26;
+            }
+        }
+        std::string body;
+        body.reserve(size);
+        body += '{';
+        for (size_t i = 0; i < job.mTrackIds.size(); i++) {
+            if (i > 0) {
+                body += ',';
+            }
+            append_json_string(body, job.mTrackIds[i]);
+            body += ":[";
+            const std::vector<std::pair<std::string, uint64_t> >& scoreList = job.mScoreLists[i];
+            for (size_t j = 0; j < scoreList.size(); j++) {
+                body += j > 0 ? ",[" : "[";
+                append_json_string(body, second_token(scoreList[j].first, '-'));
+                body += ',';
+                append_number(body, scoreList[j].second);
+                body += ']';
+            }
+            body += ']';
+        }
+        body += '}';
+        send_response(conn, "application/json", body);
+        return const_cast<char*>("");
+    } else {
+        return NULL;
+    }
+}
+
+void* handle_cache_stats_action(mg_event event, mg_connection* conn, const mg_request_info*) {
+    if (event == MG_NEW_REQUEST) {
+        RecommendCacheStats stats = cache->getStats();
+        uint64_t lookups = stats.mHits + stats.mMisses;
         mg_printf(conn, "HTTP/1.1 200 OK\r\n");
-        mg_printf(conn, "Content-Type: text/html\r\n\r\n");
-        for (size_t i = 0; i < scoreList.size() && i < limit; i++) {
-            linkTrackId = tokenize(scoreList.at(i).first, "-").at(1);
-            mg_printf(conn, "%s,%d &nbsp;&nbsp;<a href=\"http://www.beatport.com/track/_/%s\">=></a><br/>\n", scoreList.at(i).first.c_str(), scoreList.at(i).second, linkTrackId.c_str());
+        mg_printf(conn, "Content-Type: text/plain\r\n\r\n");
+        mg_printf(conn, "hits %llu\nmisses %llu\nbypasses %llu\nhit_rate %.4f\n", (unsigned long long) stats.mHits, (unsigned long long) stats.mMisses, (unsigned long long) stats.mBypasses, lookups ? (double) stats.mHits / lookups : 0.0);
+        mg_printf(conn, "evictions %llu\ninvalidations %llu\nentries %llu\nbytes %llu\n", (unsigned long long) stats.mEvictions, (unsigned long long) stats.mInvalidations, (unsigned long long) stats.mEntries, (unsigned long long) stats.mBytes);
+        if (cooccurrence) {
+            mg_printf(conn, "index_bytes %llu\nindex_applied %llu\nindex_unindexed %llu\nindex_rebuilds %llu\n", (unsigned long long) cooccurrence->getBytes(), (unsigned long long) cooccurrence->getApplied(), (unsigned long long) cooccurrence->getUnindexed(), (unsigned long long) cooccurrence->getRebuilds());
         }
         return const_cast<char*>("");
     } else {
@@ -74,19 +274,146 @@ void* handle_similar_tracks_action(mg_event event, mg_connection* conn, const mg
     }
 }
 
+// Queues the links in the body, one per line in the format of the edge
+// files, for the next snapshot.  With publish=1 the snapshot is
+// published before answering, so that the links are visible to the
+// next request.
+void* handle_links_action(mg_event event, mg_connection* conn, const mg_request_info* request) {
+    if (event == MG_NEW_REQUEST) {
+        const char* length = mg_get_header(conn, "Content-Length");
+        size_t size = length ? strtoul(length, NULL, 10) : 0;
+        if (size > maxLinksBody) {
+            mg_printf(conn, "HTTP/1.1 413 Request Entity Too Large\r\nContent-Length: 0\r\n\r\n");
+            return const_cast<char*>("");
+        }
+        std::string body(size, '\0');
+        size_t read = 0;
+        int count;
+        while (read < body.size() && (count = mg_read(conn, &body[read], body.size() - read)) > 0) {
+            read += count;
+        }
+        size_t added = live->addLinks(body.data(), read);
+        std::vector<std::pair<std::string, std::string> > params = parse_qs(request->query_string);
+        bool published = get_param_value(params, "publish", "0") == "1" && live->publish();
+        std::string response = "links ";
+        append_number(response, added);
+        response += "\npublished ";
+        append_number(response, published);
+        response += "\n";
+        send_response(conn, "text/plain", response);
+        return const_cast<char*>("");
+    } else {
+        return NULL;
+    }
+}
+
+void* handle_ingest_stats_action(mg_event event, mg_connection* conn, const mg_request_info*) {
+    if (event == MG_NEW_REQUEST) {
+        LiveGraphStats stats = live->getStats();
+        mg_printf(conn, "HTTP/1.1 200 OK\r\n");
+        mg_printf(conn, "Content-Type: text/plain\r\n\r\n");
+        mg_printf(conn, "links %llu\ninvalid %llu\npending %llu\nsnapshots %llu\ncompactions %llu\noverlay_links %llu\nnodes %llu\nedges %llu\n", (unsigned long long) stats.mLinks, (unsigned long long) stats.mInvalid, (unsigned long long) stats.mPending, (unsigned long long) stats.mSnapshots, (unsigned long long) stats.mCompactions, (unsigned long long) stats.mOverlayLinks, (unsigned long long) stats.mNodes, (unsigned long long) stats.mEdges);
+        mg_printf(conn, "publish_us_last %llu\npublish_us_max %llu\npublish_us_total %llu\ngrace_us_total %llu\n", (unsigned long long) stats.mLastPublishMicros, (unsigned long long) stats.mMaxPublishMicros, (unsigned long long) stats.mTotalPublishMicros, (unsigned long long) stats.mTotalGraceMicros);
+        mg_printf(conn, "listener_us_last %llu\nlistener_us_max %llu\nlistener_us_total %llu\n", (unsigned long long) stats.mLastListenerMicros, (unsigned long long) stats.mMaxListenerMicros, (unsigned long long) stats.mTotalListenerMicros);
+        return const_cast<char*>("");
+    } else {
+        return NULL;
+    }
+}
+
 static void* http_callback(mg_event event, mg_connection* conn, const mg_request_info* request) {
+    if (strcmp(request->uri, "/similar-tracks/batch") == 0) {
+        return handle_similar_tracks_batch_action(event, conn, request);
+    }
     if (strcmp(request->uri, "/similar-tracks/") == 0 || strcmp(request->uri, "/similar-tracks") == 0) {
         return handle_similar_tracks_action(event, conn, request);
     }
+    if (strcmp(request->uri, "/cache-stats") == 0) {
+        return handle_cache_stats_action(event, conn, request);
+    }
+    if (strcmp(request->uri, "/links") == 0 && strcmp(request->request_method, "POST") == 0) {
+        return handle_links_action(event, conn, request);
+    }
+    if (strcmp(request->uri, "/ingest-stats") == 0) {
+        return handle_ingest_stats_action(event, conn, request);
+    }
     return NULL;
 }
 
+/*
+ * Usage: ab3 [--snapshot file [--verify]] [--save-snapshot file]
+ *            [--cache-mb megabytes] [--cache-top n] [--index-top n]
+ *            [--publish-ms milliseconds]
+ *            [edge files...]
+ *
+ * With --snapshot the graph is mapped from a snapshot saved earlier
+ * with --save-snapshot, instead of being loaded from edge files.  The
+ * result cache keeps the top --cache-top recommendations of each track
+ * it caches, in at most --cache-mb megabytes.  --index-top builds a
+ * co-occurrence index of the top n recommendations of every track at
+ * startup; requests it cannot answer go through the cache.
+ *
+ * /similar-tracks/batch answers for many tracks at once, in JSON.
+ *
+ * Links POSTed to /links are merged into a new snapshot of the graph
+ * every --publish-ms milliseconds, which requests pick up without
+ * locking; /ingest-stats reports on them.  The index is rebuilt in the
+ * background whenever the snapshots are compacted.
+ */
 int main(int argc, char** argv) {
-    graph = new Graph();
+    std::vector<std::string> files;
+    const char* snapshot = NULL;
+    const char* saveSnapshot = NULL;
+    bool verify = false;
+    size_t cacheMegabytes = 64;
+    size_t cacheTop = 100;
+    size_t indexTop = 0;
+    unsigned int publishMillis = 1000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            saveSnapshot = argv[++i];
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cacheMegabytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-top") == 0 && i + 1 < argc) {
+            cacheTop = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--index-top") == 0 && i + 1 < argc) {
+            indexTop = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--publish-ms") == 0 && i + 1 < argc) {
+            publishMillis = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (snapshot) {
+        graph = CsrGraph::load(snapshot, verify);
+        if (!graph) {
+            return 1;
+        }
+    } else {
+        graph = loadGraph(files, cores);
+    }
+    if (saveSnapshot && !graph->save(saveSnapshot)) {
+        delete graph;
+        return 1;
+    }
 
-    for (unsigned short i = 1; i < argc; i++) {
-        populateGraph(argv[i], graph);
+    cache = new RecommendCache(cacheMegabytes << 20, cacheTop, 16);
+    if (indexTop) {
+        cooccurrence = new CooccurrenceIndex(graph, "track-", indexTop, cores);
+    }
+    live = new LiveGraph(graph);
+    live->addSnapshotListener(cache);
+    if (cooccurrence) {
+        live->addSnapshotListener(cooccurrence);
     }
+    live->start(publishMillis);
+    start_batch_workers(cores > 1 ? cores - 1 : 0);
 
     struct mg_context *ctx;
     const char *options[] = {"listening_ports", "8080", NULL};
@@ -95,5 +422,11 @@ int main(int argc, char** argv) {
     getchar();
     mg_stop(ctx);
 
+    stop_batch_workers();
+    live->stop();
+    // The index releases the snapshots it retained, so it goes first.
+    delete cooccurrence;
+    delete live;
+    delete cache;
     delete graph;
 }
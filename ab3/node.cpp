@@ -2,23 +2,41 @@
 
 Node::Node(std::string id) {
     mId = id;
+    mIndex = 0;
     mNeighbors = new std::vector<Node*>;
+    mWeights = new std::vector<uint32_t>;
 }
 
 Node::~Node() {
     delete mNeighbors;
+    delete mWeights;
 }
 
 std::string Node::getId() {
     return mId;
 }
 
+uint32_t Node::getIndex() {
+    return mIndex;
+}
+
+void Node::setIndex(uint32_t index) {
+    mIndex = index;
+}
+
 std::vector<Node*>* Node::getNeighbors() {
     return mNeighbors;
 }
 
-void Node::addNeighbor(Node* node) {
+std::vector<uint32_t>* Node::getWeights() {
+    return mWeights;
+}
+
+// Neighbors are appended as links come in, repeats included; they are
+// merged when the graph is frozen into a CsrGraph.
+void Node::addNeighbor(Node* node, uint32_t weight) {
     mNeighbors->push_back(node);
+    mWeights->push_back(weight);
 }
 
 std::ostream& operator<<(std::ostream& os, Node* node) {
@@ -4,17 +4,23 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <stdint.h>
 
 class Node {
 private:
     std::string mId;
+    uint32_t mIndex;
     std::vector<Node*>* mNeighbors;
+    std::vector<uint32_t>* mWeights;
 public:
     Node(std::string);
     ~Node();
     std::string getId();
+    uint32_t getIndex();
+    void setIndex(uint32_t);
     std::vector<Node*>* getNeighbors();
-    void addNeighbor(Node*);
+    std::vector<uint32_t>* getWeights();
+    void addNeighbor(Node*, uint32_t);
     friend std::ostream& operator<<(std::ostream&, Node*);
 };
 
@@ -0,0 +1,48 @@
+#include <pthread.h>
+#include <sched.h>
+#include "reader_epochs.hpp"
+#include "id_dictionary.hpp"
+
+ReaderEpochs::ReaderEpochs() : mEpoch(1) {
+    for (unsigned int i = 0; i < slotCount; i++) {
+        mSlots[i].mEpoch = 0;
+    }
+}
+
+// Claims a free slot for the calling thread, marked with the current
+// epoch.  Threads start looking at different slots, so they rarely
+// contend for one.  If the epoch moves on before the slot is claimed,
+// the slot only claims to be older than it is, which just makes the
+// next writer wait for it.  Sequentially consistent loads are plain
+// loads on x86, so readers only pay for the one compare-and-swap.
+unsigned int ReaderEpochs::enter() {
+    pthread_t self = pthread_self();
+    unsigned int slot = hashName(reinterpret_cast<const char*>(&self), sizeof(self)) % slotCount;
+    for (unsigned int tries = 1; !__sync_bool_compare_and_swap(&mSlots[slot].mEpoch, 0, __atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST)); tries++) {
+        slot = (slot + 1) % slotCount;
+        if (tries % slotCount == 0) {
+            sched_yield();
+        }
+    }
+    return slot;
+}
+
+void ReaderEpochs::leave(unsigned int slot) {
+    __sync_lock_release(&mSlots[slot].mEpoch);
+}
+
+// Starts a new epoch, once the replaced data is out of reach, and
+// returns it for synchronize().
+uint64_t ReaderEpochs::advance() {
+    return __sync_add_and_fetch(&mEpoch, 1);
+}
+
+// Waits until every reader that entered before the epoch has left.
+void ReaderEpochs::synchronize(uint64_t epoch) {
+    for (unsigned int i = 0; i < slotCount; i++) {
+        uint64_t entered;
+        while ((entered = __atomic_load_n(&mSlots[i].mEpoch, __ATOMIC_SEQ_CST)) != 0 && entered < epoch) {
+            sched_yield();
+        }
+    }
+}
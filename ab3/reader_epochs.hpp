@@ -0,0 +1,35 @@
+#ifndef READER_EPOCHS_HPP
+#define READER_EPOCHS_HPP
+
+#include <stdint.h>
+
+/*
+ * Lets readers use data that a writer replaces by a pointer store
+ * without taking a lock.  A reader holds one of a fixed set of slots
+ * while it uses the data, marked with the epoch it started in.  After
+ * replacing some data, the writer starts a new epoch and waits until
+ * no slot is left from an older one before deleting what it replaced.
+ */
+class ReaderEpochs {
+private:
+    struct Slot {
+        uint64_t mEpoch;
+        char mPadding[56];
+    };
+
+    static const unsigned int slotCount = 256;
+
+    uint64_t mEpoch;
+    Slot mSlots[slotCount];
+
+    ReaderEpochs(const ReaderEpochs&);
+    ReaderEpochs& operator=(const ReaderEpochs&);
+public:
+    ReaderEpochs();
+    unsigned int enter();
+    void leave(unsigned int);
+    uint64_t advance();
+    void synchronize(uint64_t);
+};
+
+#endif
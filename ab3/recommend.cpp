@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <pthread.h>
+#include "recommend.hpp"
+
+void ScoreCounter::resize(uint32_t nodes) {
+    if (mCounts.size() < nodes) {
+        mCounts.resize(nodes, 0);
+        mSeen.resize(nodes, false);
+    }
+}
+
+// Moves the counts into the given list and leaves the counter zeroed
+// for the next request.
+void ScoreCounter::drain(std::vector<std::pair<uint32_t, uint64_t> >& scores) {
+    scores.reserve(scores.size() + mTouched.size());
+    for (size_t i = 0; i < mTouched.size(); i++) {
+        scores.push_back(std::make_pair(mTouched[i], mCounts[mTouched[i]]));
+        mCounts[mTouched[i]] = 0;
+        mSeen[mTouched[i]] = false;
+    }
+    mTouched.clear();
+}
+
+namespace {
+
+// Each thread keeps its counter, sized for the largest graph it has
+// served, across requests.
+pthread_key_t counterKey;
+pthread_once_t counterOnce = PTHREAD_ONCE_INIT;
+
+void deleteCounter(void* counter) {
+    delete static_cast<ScoreCounter*>(counter);
+}
+
+void createCounterKey() {
+    pthread_key_create(&counterKey, deleteCounter);
+}
+
+ScoreCounter* threadCounter() {
+    pthread_once(&counterOnce, createCounterKey);
+    ScoreCounter* counter = static_cast<ScoreCounter*>(pthread_getspecific(counterKey));
+    if (!counter) {
+        counter = new ScoreCounter;
+        pthread_setspecific(counterKey, counter);
+    }
+    return counter;
+}
+
+// product * 65536 / total, split so that neither part overflows: the
+// whole part is at most one weight, since the track weight in product
+// is part of total, and only absurd totals lose fraction bits.
+uint64_t normalizedAmount(uint64_t product, uint64_t total) {
+    uint64_t whole = product / total;
+    uint64_t rest = product % total;
+    if (total < (1ULL << 48)) {
+        return (whole << 16) + (rest << 16) / total;
+    }
+    return (whole << 16) + rest / (total >> 16);
+}
+
+// Orders like sortIdPairs, but asks the graph for the name order of
+// tied ids, which in overlays differs from their id order.
+struct IdPairOrder {
+    CsrGraph* mGraph;
+    IdPairOrder(CsrGraph* graph) : mGraph(graph) {}
+    bool operator()(const std::pair<uint32_t, uint64_t>& a, const std::pair<uint32_t, uint64_t>& b) const {
+        if (a.second == b.second) {
+            return mGraph->nameLess(b.first, a.first);
+        } else {
+            return a.second > b.second;
+        }
+    }
+};
+
+}
+
+bool sortIdPairs(std::pair<uint32_t, uint64_t> a, std::pair<uint32_t, uint64_t> b) {
+    if (a.second == b.second) {
+        return a.first > b.first;
+    } else {
+        return a.second > b.second;
+    }
+}
+
+bool sortPairs(std::pair<std::string, uint64_t> a, std::pair<std::string, uint64_t> b) {
+    if (a.second == b.second) {
+        return a.first > b.first;
+    } else {
+        return a.second > b.second;
+    }
+}
+
+std::vector<std::pair<std::string, uint64_t> > recommend(CsrGraph* g, std::string nodeId, size_t limit, ScoreMode mode) {
+    std::vector<std::pair<std::string, uint64_t> > scoreList;
+    uint32_t node;
+    if (!g->findId(nodeId, node)) {
+        return scoreList;
+    }
+
+    ScoreCounter* counter = threadCounter();
+    counter->resize(g->size());
+    const uint32_t* charts = g->getNeighbors(node);
+    const uint32_t* chartWeights = g->getWeights(node);
+    uint64_t chartCount = g->getDegree(node);
+    for (uint64_t i = 0; i < chartCount; i++) {
+        const uint32_t* tracks = g->getNeighbors(charts[i]);
+        const uint32_t* trackWeights = g->getWeights(charts[i]);
+        uint64_t trackCount = g->getDegree(charts[i]);
+        uint64_t total = 0;
+        if (mode == SCORE_NORMALIZED) {
+            for (uint64_t j = 0; j < trackCount; j++) {
+                total += trackWeights[j];
+            }
+            if (total == 0) {
+                continue;
+            }
+        }
+        for (uint64_t j = 0; j < trackCount; j++) {
+            if (tracks[j] == node) {
+                continue;
+            }
+            uint64_t amount = 1;
+            if (mode == SCORE_MULTIPLICITY) {
+                amount = (uint64_t) chartWeights[i] * trackWeights[j];
+            } else if (mode == SCORE_NORMALIZED) {
+                amount = std::max((uint64_t) 1, normalizedAmount((uint64_t) chartWeights[i] * trackWeights[j], total));
+            }
+            counter->add(tracks[j], amount);
+        }
+    }
+
+    // Ties are broken in name order, so exactly like sortPairs does by
+    // name, without comparing names.  Only the best limit entries are
+    // put in order; the rest are cut off unsorted.
+    std::vector<std::pair<uint32_t, uint64_t> > idScores;
+    counter->drain(idScores);
+    IdPairOrder order(g);
+    if (idScores.size() > limit) {
+        std::nth_element(idScores.begin(), idScores.begin() + limit, idScores.end(), order);
+        idScores.resize(limit);
+    }
+    std::sort(idScores.begin(), idScores.end(), order);
+
+    scoreList.reserve(idScores.size());
+    for (size_t i = 0; i < idScores.size(); i++) {
+        scoreList.push_back(std::make_pair(g->getName(idScores[i].first), idScores[i].second));
+    }
+
+    return scoreList;
+}
+
+bool parseScoreMode(const std::string& name, ScoreMode& mode) {
+    if (name == "shared") {
+        mode = SCORE_SHARED;
+    } else if (name == "multiplicity") {
+        mode = SCORE_MULTIPLICITY;
+    } else if (name == "normalized") {
+        mode = SCORE_NORMALIZED;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef RECOMMEND_HPP
+#define RECOMMEND_HPP
+
+#include <vector>
+#include <string>
+#include "csr_graph.hpp"
+
+/*
+ * How recommend() scores a candidate reached from the node through a
+ * shared neighbor c, given the weights of the two edges:
+ *   SCORE_SHARED        1 per shared neighbor
+ *   SCORE_MULTIPLICITY  the product of the two weights, which with
+ *                       unweighted input counts repeated links
+ *   SCORE_NORMALIZED    that product as a fraction of the total weight
+ *                       of c, in units of 1/65536, so that crowded
+ *                       neighbors count for less
+ */
+enum ScoreMode {
+    SCORE_SHARED,
+    SCORE_MULTIPLICITY,
+    SCORE_NORMALIZED
+};
+
+/*
+ * Scratch space for counting two-hop neighbors: one 64-bit score per
+ * node id, plus the list of ids touched so far so that reading out and
+ * resetting costs O(touched) instead of O(nodes).  Ids are marked as
+ * touched separately, so adding nothing to a score still lists it
+ * exactly once.
+ */
+class ScoreCounter {
+private:
+    std::vector<uint64_t> mCounts;
+    std::vector<bool> mSeen;
+    std::vector<uint32_t> mTouched;
+public:
+    void resize(uint32_t);
+    void add(uint32_t id, uint64_t amount) {
+        if (!mSeen[id]) {
+            mSeen[id] = true;
+            mTouched.push_back(id);
+        }
+        mCounts[id] += amount;
+    }
+    void drain(std::vector<std::pair<uint32_t, uint64_t> >&);
+};
+
+bool sortPairs(std::pair<std::string, uint64_t>, std::pair<std::string, uint64_t>);
+bool sortIdPairs(std::pair<uint32_t, uint64_t>, std::pair<uint32_t, uint64_t>);
+std::vector<std::pair<std::string, uint64_t> > recommend(CsrGraph*, std::string, size_t, ScoreMode = SCORE_MULTIPLICITY);
+bool parseScoreMode(const std::string&, ScoreMode&);
+
+#endif
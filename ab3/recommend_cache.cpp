@@ -0,0 +1,197 @@
+#include <algorithm>
+#include "recommend_cache.hpp"
+#include "recommend.hpp"
+
+namespace {
+
+// Rough cost of an entry besides its strings and score list: the entry
+// itself and its node in the shard index.
+const size_t entryOverhead = 128;
+
+}
+
+RecommendCache::RecommendCache(size_t maxBytes, size_t topN, unsigned int shards) : mTopN(topN) {
+    if (shards == 0) {
+        shards = 1;
+    }
+    mShardBytes = maxBytes / shards;
+    for (unsigned int i = 0; i < shards; i++) {
+        Shard* shard = new Shard;
+        pthread_mutex_init(&shard->mLock, NULL);
+        shard->mHand = 0;
+        shard->mBytes = 0;
+        shard->mHits = 0;
+        shard->mMisses = 0;
+        shard->mBypasses = 0;
+        shard->mEvictions = 0;
+        shard->mInvalidations = 0;
+        mShards.push_back(shard);
+    }
+}
+
+RecommendCache::~RecommendCache() {
+    for (size_t i = 0; i < mShards.size(); i++) {
+        pthread_mutex_destroy(&mShards[i]->mLock);
+        delete mShards[i];
+    }
+}
+
+RecommendCache::Shard* RecommendCache::shardOf(const std::string& track) {
+    return mShards[hashName(track.data(), track.size()) % mShards.size()];
+}
+
+// Serves the request from the cached top N of the track, computing and
+// caching it first if needed.  A list shorter than N is complete, so it
+// serves any limit.  Concurrent misses on one track may both compute
+// it; the first to finish gets to insert it.
+std::vector<std::pair<std::string, uint64_t> > RecommendCache::recommend(CsrGraph* graph, const std::string& track, size_t limit) {
+    Shard* shard = shardOf(track);
+    pthread_mutex_lock(&shard->mLock);
+    std::map<std::string, size_t>::iterator found = shard->mIndex.find(track);
+    if (found != shard->mIndex.end() && (limit <= mTopN || shard->mRing[found->second].mScores.size() < mTopN)) {
+        Entry& entry = shard->mRing[found->second];
+        entry.mReferenced = true;
+        shard->mHits++;
+        std::vector<std::pair<std::string, uint64_t> > scores(entry.mScores.begin(), entry.mScores.begin() + std::min(limit, entry.mScores.size()));
+        pthread_mutex_unlock(&shard->mLock);
+        return scores;
+    }
+    if (limit > mTopN) {
+        shard->mBypasses++;
+        pthread_mutex_unlock(&shard->mLock);
+        return ::recommend(graph, track, limit);
+    }
+    shard->mMisses++;
+    pthread_mutex_unlock(&shard->mLock);
+
+    std::vector<std::pair<std::string, uint64_t> > scores = ::recommend(graph, track, mTopN);
+    pthread_mutex_lock(&shard->mLock);
+    insert(shard, track, scores);
+    pthread_mutex_unlock(&shard->mLock);
+    if (scores.size() > limit) {
+        scores.resize(limit);
+    }
+    return scores;
+}
+
+// Called with the shard locked.  Sweeps the CLOCK hand until enough
+// entries have been evicted to make room; entries used since the hand
+// last passed get another round.
+void RecommendCache::insert(Shard* shard, const std::string& track, const std::vector<std::pair<std::string, uint64_t> >& scores) {
+    if (shard->mIndex.count(track)) {
+        return;
+    }
+    size_t bytes = entryOverhead + 2 * track.size() + scores.size() * sizeof(scores[0]);
+    for (size_t i = 0; i < scores.size(); i++) {
+        bytes += scores[i].first.size();
+    }
+    if (bytes > mShardBytes) {
+        return;
+    }
+
+    while (shard->mBytes + bytes > mShardBytes) {
+        size_t slot = shard->mHand;
+        shard->mHand = (shard->mHand + 1) % shard->mRing.size();
+        Entry& entry = shard->mRing[slot];
+        if (!entry.mBytes) {
+            continue;
+        }
+        if (entry.mReferenced) {
+            entry.mReferenced = false;
+        } else {
+            evict(shard, slot);
+            shard->mEvictions++;
+        }
+    }
+
+    size_t slot;
+    if (shard->mFree.empty()) {
+        slot = shard->mRing.size();
+        shard->mRing.push_back(Entry());
+    } else {
+        slot = shard->mFree.back();
+        shard->mFree.pop_back();
+    }
+    Entry& entry = shard->mRing[slot];
+    entry.mTrack = track;
+    entry.mScores = scores;
+    entry.mBytes = bytes;
+    entry.mReferenced = true;
+    shard->mIndex[track] = slot;
+    shard->mBytes += bytes;
+}
+
+// Called with the shard locked.  Frees the strings of the entry and
+// puts its slot on the free list.
+void RecommendCache::evict(Shard* shard, size_t slot) {
+    Entry& entry = shard->mRing[slot];
+    shard->mIndex.erase(entry.mTrack);
+    shard->mBytes -= entry.mBytes;
+    std::string().swap(entry.mTrack);
+    std::vector<std::pair<std::string, uint64_t> >().swap(entry.mScores);
+    entry.mBytes = 0;
+    shard->mFree.push_back(slot);
+}
+
+void RecommendCache::invalidate(const std::string& track) {
+    Shard* shard = shardOf(track);
+    pthread_mutex_lock(&shard->mLock);
+    std::map<std::string, size_t>::iterator found = shard->mIndex.find(track);
+    if (found != shard->mIndex.end()) {
+        evict(shard, found->second);
+        shard->mInvalidations++;
+    }
+    pthread_mutex_unlock(&shard->mLock);
+}
+
+// The recommendations of a track are the neighbors of its neighbors,
+// so a new link changes those of both nodes and of every node next to
+// either of them.
+void RecommendCache::linkAdded(Node* one, Node* two, uint32_t) {
+    Node* nodes[] = {one, two};
+    for (size_t i = 0; i < 2; i++) {
+        invalidate(nodes[i]->getId());
+        std::vector<Node*>* neighbors = nodes[i]->getNeighbors();
+        for (size_t j = 0; j < neighbors->size(); j++) {
+            invalidate(neighbors->at(j)->getId());
+        }
+    }
+}
+
+void RecommendCache::snapshotPublished(LiveGraph*, CsrGraph* graph, const std::vector<CsrLink>& links) {
+    std::vector<uint32_t> nodes;
+    for (size_t i = 0; i < links.size(); i++) {
+        const std::string* ends[] = {&links[i].mOne, &links[i].mTwo};
+        for (size_t j = 0; j < 2; j++) {
+            uint32_t id;
+            if (!graph->findId(*ends[j], id)) {
+                continue;
+            }
+            nodes.push_back(id);
+            const uint32_t* neighbors = graph->getNeighbors(id);
+            nodes.insert(nodes.end(), neighbors, neighbors + graph->getDegree(id));
+        }
+    }
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        invalidate(graph->getName(nodes[i]));
+    }
+}
+
+RecommendCacheStats RecommendCache::getStats() {
+    RecommendCacheStats stats = RecommendCacheStats();
+    for (size_t i = 0; i < mShards.size(); i++) {
+        Shard* shard = mShards[i];
+        pthread_mutex_lock(&shard->mLock);
+        stats.mHits += shard->mHits;
+        stats.mMisses += shard->mMisses;
+        stats.mBypasses += shard->mBypasses;
+        stats.mEvictions += shard->mEvictions;
+        stats.mInvalidations += shard->mInvalidations;
+        stats.mEntries += shard->mIndex.size();
+        stats.mBytes += shard->mBytes;
+        pthread_mutex_unlock(&shard->mLock);
+    }
+    return stats;
+}
@@ -0,0 +1,79 @@
+#ifndef RECOMMEND_CACHE_HPP
+#define RECOMMEND_CACHE_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include "csr_graph.hpp"
+#include "graph.hpp"
+#include "live_graph.hpp"
+
+struct RecommendCacheStats {
+    uint64_t mHits;
+    uint64_t mMisses;
+    uint64_t mBypasses;
+    uint64_t mEvictions;
+    uint64_t mInvalidations;
+    uint64_t mEntries;
+    uint64_t mBytes;
+};
+
+/*
+ * Bounded cache of recommendation results, keyed by track id.  Each
+ * entry holds the ranked top N of a track, which answers any request
+ * with a limit up to N, or any limit at all if the list is shorter
+ * than N.  Other requests bypass the cache.  Tracks are spread over
+ * shards with a lock and a CLOCK ring each, and a shard evicts once its
+ * estimated memory use passes its share of the budget.
+ *
+ * Registered as a link listener of a Graph, the cache drops every
+ * entry whose result a new link can change: the two linked nodes and
+ * all of their neighbors.  As a snapshot listener of a LiveGraph it
+ * does the same for every link of a new snapshot, with the neighbors
+ * the nodes have in that snapshot.
+ */
+class RecommendCache : public LinkListener, public SnapshotListener {
+private:
+    struct Entry {
+        std::string mTrack;
+        std::vector<std::pair<std::string, uint64_t> > mScores;
+        size_t mBytes;
+        bool mReferenced;
+    };
+
+    struct Shard {
+        pthread_mutex_t mLock;
+        std::map<std::string, size_t> mIndex;
+        std::vector<Entry> mRing;
+        std::vector<size_t> mFree;
+        size_t mHand;
+        size_t mBytes;
+        uint64_t mHits;
+        uint64_t mMisses;
+        uint64_t mBypasses;
+        uint64_t mEvictions;
+        uint64_t mInvalidations;
+    };
+
+    std::vector<Shard*> mShards;
+    size_t mShardBytes;
+    size_t mTopN;
+
+    RecommendCache(const RecommendCache&);
+    RecommendCache& operator=(const RecommendCache&);
+    Shard* shardOf(const std::string&);
+    void insert(Shard*, const std::string&, const std::vector<std::pair<std::string, uint64_t> >&);
+    void evict(Shard*, size_t);
+public:
+    RecommendCache(size_t, size_t, unsigned int);
+    ~RecommendCache();
+    std::vector<std::pair<std::string, uint64_t> > recommend(CsrGraph*, const std::string&, size_t);
+    void invalidate(const std::string&);
+    void linkAdded(Node*, Node*, uint32_t);
+    void snapshotPublished(LiveGraph*, CsrGraph*, const std::vector<CsrLink>&);
+    RecommendCacheStats getStats();
+};
+
+#endif
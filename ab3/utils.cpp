@@ -47,3 +47,69 @@ std::string get_param_value(std::vector<std::pair<std::string, std::string> > pa
     }
     return default_value;
 }
+
+// Edge weights are positive integers.  Anything else, including a
+// missing token, counts as a weight of 1.
+uint32_t parse_weight(const char* token, size_t length) {
+    uint64_t weight = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (token[i] < '0' || token[i] > '9') {
+            return 1;
+        }
+        weight = weight * 10 + (token[i] - '0');
+        if (weight > 0xffffffffULL) {
+            return 0xffffffffU;
+        }
+    }
+    return weight ? weight : 1;
+}
+
+// Weights of repeated links add up, but stop at the largest weight
+// instead of wrapping around to a small or zero one.
+uint32_t add_weight(uint32_t one, uint32_t two) {
+    uint32_t sum = one + two;
+    return sum < one ? 0xffffffffU : sum;
+}
+
+// Same as tokenize(str, delimiter).at(1) for a single delimiter, but
+// without building the token list; empty if there is no second token.
+std::string second_token(const std::string& str, char delimiter) {
+    size_t start = str.find_first_not_of(delimiter);
+    start = str.find(delimiter, start);
+    start = str.find_first_not_of(delimiter, start);
+    if (start == std::string::npos) {
+        return "";
+    }
+    return str.substr(start, str.find(delimiter, start) - start);
+}
+
+void append_number(std::string& out, uint64_t number) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + number % 10;
+        number /= 10;
+    } while (number);
+    while (count) {
+        out += digits[--count];
+    }
+}
+
+void append_json_string(std::string& out, const std::string& str) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (size_t i = 0; i < str.size(); i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
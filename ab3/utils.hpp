@@ -3,9 +3,15 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 std::vector<std::string> tokenize(std::string, std::string);
 std::vector<std::pair<std::string, std::string> > parse_qs(char*);
 std::string get_param_value(std::vector<std::pair<std::string, std::string> >, std::string, std::string);
+uint32_t parse_weight(const char*, size_t);
+uint32_t add_weight(uint32_t, uint32_t);
+std::string second_token(const std::string&, char);
+void append_number(std::string&, uint64_t);
+void append_json_string(std::string&, const std::string&);
 
 #endif
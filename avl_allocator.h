@@ -0,0 +1,226 @@
+#ifndef _AVL_ALLOCATOR_H
+#define _AVL_ALLOCATOR_H
+
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The default node allocator of the AVL tree.  Every node is a
+ * separate trip to the global heap, exactly like a plain new/delete.
+ * Allocators only hand out raw storage; constructing and destroying
+ * the node itself is left to the tree.
+ */
+template <class N>
+class AVLNewAllocator {
+public:
+    /**
+     * Whether release() frees every outstanding node at once, which
+     * lets the tree skip walking itself on clear() when it has no
+     * destructors to run.
+     */
+    static const bool bulkRelease = false;
+
+    /**
+     * Returns uninitialized storage for one node.
+     */
+    N* allocate();
+
+    /**
+     * Gives back the storage of one node.
+     */
+    void deallocate(N*);
+
+    /**
+     * Called once all nodes have been destroyed.  Nothing to do here
+     * since each node was already handed back individually.
+     */
+    void release();
+
+    /**
+     * Takes over the nodes handed out by another allocator, so that
+     * they can be moved to a tree using this one.  Heap nodes belong
+     * to nobody, so there is nothing to do.
+     */
+    void adopt(AVLNewAllocator&);
+};
+
+/**
+ * A slab/arena allocator for tree nodes.  Nodes are carved out of
+ * large contiguous slabs, so neighbouring insertions stay close in
+ * memory, and freed nodes go on an intrusive free list to be reused
+ * by the next allocation.  release() returns all slabs to the heap in
+ * one go regardless of how many nodes were carved out of them.
+ */
+template <class N>
+class AVLPoolAllocator {
+private:
+    /**
+     * A freed node's storage is reused as a link of the free list.
+     */
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    /**
+     * Every slab allocated so far, in allocation order.
+     */
+    vector<void*> slabs;
+
+    /**
+     * The next never-used node of the newest slab and the end of it.
+     */
+    N* cursor;
+    N* limit;
+
+    /**
+     * Head of the list of nodes that have been deallocated.
+     */
+    FreeNode* freeList;
+
+    /**
+     * Number of nodes in the next slab.  Slabs start small so tiny
+     * trees stay tiny and double up to a fixed cap.
+     */
+    size_t slabNodes;
+
+    /**
+     * Slabs never grow past this many bytes.
+     */
+    static const size_t maxSlabBytes = 1 << 20;
+
+    /**
+     * Disallow copying; two pools must never own the same slabs.
+     */
+    AVLPoolAllocator(const AVLPoolAllocator&);
+    AVLPoolAllocator& operator=(const AVLPoolAllocator&);
+public:
+    static const bool bulkRelease = true;
+
+    /**
+     * Constructor--starts without any slabs.
+     */
+    AVLPoolAllocator();
+
+    /**
+     * Destructor--frees all slabs.
+     */
+    ~AVLPoolAllocator();
+
+    /**
+     * Returns uninitialized storage for one node, taken from the free
+     * list if possible and from the current slab otherwise.
+     */
+    N* allocate();
+
+    /**
+     * Puts the storage of one node on the free list.
+     */
+    void deallocate(N*);
+
+    /**
+     * Frees every slab, invalidating all nodes handed out so far.
+     */
+    void release();
+
+    /**
+     * Takes over all slabs and free nodes of another pool, which is
+     * left empty.  Nodes of both pools then live until this one is
+     * released.  The unused tail of the other pool's newest slab is
+     * not reused.
+     */
+    void adopt(AVLPoolAllocator&);
+};
+
+
+template <class N>
+N* AVLNewAllocator<N>::allocate() {
+    return static_cast<N*>(::operator new(sizeof(N)));
+}
+
+template <class N>
+void AVLNewAllocator<N>::deallocate(N* node) {
+    ::operator delete(node);
+}
+
+template <class N>
+void AVLNewAllocator<N>::release() {
+}
+
+template <class N>
+void AVLNewAllocator<N>::adopt(AVLNewAllocator&) {
+}
+
+template <class N>
+AVLPoolAllocator<N>::AVLPoolAllocator() {
+    this->cursor = NULL;
+    this->limit = NULL;
+    this->freeList = NULL;
+    this->slabNodes = 16;
+}
+
+template <class N>
+AVLPoolAllocator<N>::~AVLPoolAllocator() {
+    this->release();
+}
+
+template <class N>
+N* AVLPoolAllocator<N>::allocate() {
+    if (this->freeList) {
+        FreeNode* node = this->freeList;
+        this->freeList = node->next;
+        return reinterpret_cast<N*>(node);
+    }
+
+    if (this->cursor == this->limit) {
+        void* slab = ::operator new(this->slabNodes * sizeof(N));
+        this->slabs.push_back(slab);
+        this->cursor = static_cast<N*>(slab);
+        this->limit = this->cursor + this->slabNodes;
+        if (this->slabNodes * sizeof(N) * 2 <= maxSlabBytes) {
+            this->slabNodes *= 2;
+        }
+    }
+
+    return this->cursor++;
+}
+
+template <class N>
+void AVLPoolAllocator<N>::deallocate(N* node) {
+    FreeNode* free = reinterpret_cast<FreeNode*>(node);
+    free->next = this->freeList;
+    this->freeList = free;
+}
+
+template <class N>
+void AVLPoolAllocator<N>::release() {
+    for (size_t i = 0; i < this->slabs.size(); i++) {
+        ::operator delete(this->slabs[i]);
+    }
+    this->slabs.clear();
+    this->cursor = NULL;
+    this->limit = NULL;
+    this->freeList = NULL;
+    this->slabNodes = 16;
+}
+
+template <class N>
+void AVLPoolAllocator<N>::adopt(AVLPoolAllocator& other) {
+    this->slabs.insert(this->slabs.end(), other.slabs.begin(), other.slabs.end());
+    if (other.freeList) {
+        FreeNode* last = other.freeList;
+        while (last->next) {
+            last = last->next;
+        }
+        last->next = this->freeList;
+        this->freeList = other.freeList;
+    }
+
+    other.slabs.clear();
+    other.cursor = NULL;
+    other.limit = NULL;
+    other.freeList = NULL;
+}
+
+#endif
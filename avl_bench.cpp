@@ -0,0 +1,377 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include "avl_tree.h"
+#include "concurrent_avl_tree.h"
+
+using namespace std;
+
+/**
+ * Benchmarks for AVLTree.
+ *
+ * The scaling section loads, probes and erases n random keys for
+ * n = 1000, 10000, ... up to the limit given on the command line (10M
+ * by default) and reports the cost per operation, both raw and divided
+ * by log2(n).  The second column staying flat is what logarithmic
+ * behaviour looks like.  A full in-order scan is timed as well.
+ *
+ * The allocator section runs an insert-heavy load followed by a
+ * teardown, and a churn-heavy workload (random erase + insert at a
+ * steady size), once with the default new/delete allocator and once
+ * with the pool allocator.
+ *
+ * The startup section rebuilds a tree of 1M and 10M keys (as far as
+ * the limit allows) from a sorted dump, once by repeated insert() and
+ * once by bulkLoad(), and merges a shuffled batch as large as the tree
+ * into it, once by repeated insert() and once by insertMany().  It
+ * also saves the merged tree to a binary file and loads it back.
+ *
+ * The lookup section measures random hit lookups against the pointer
+ * tree and against its frozen copy at 1M, 10M and 100M keys (again as
+ * far as the limit allows).
+ *
+ * The merging section merges two trees of n random keys each (as far
+ * as the limit allows, from 1M up), once by inserting every entry of
+ * one into the other and once by unionWith() on one thread and on all
+ * cores, and times intersect() and difference() the same way.
+ *
+ * The threads section runs 1 to 64 threads against a shared tree of up
+ * to 1M keys with 100/0, 95/5 and 50/50 read/write mixes, once on an
+ * AVLTree behind one mutex and once on a ConcurrentAVLTree, and reports
+ * the total throughput.
+ *
+ * Comparisons against the standard containers live in avl_compare.cpp.
+ *
+ * Build with: g++ -O2 -std=c++11 -pthread avl_bench.cpp -o avl_bench
+ */
+
+static double elapsedNs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* op, const char* variant, size_t n, double ns) {
+    double perOp = ns / n;
+    cout << op << "\t" << variant << "\t" << n << "\t" << perOp << "\t" << perOp / log2((double) n) << endl;
+}
+
+static vector<int> shuffledKeys(size_t n, mt19937& rng) {
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (int) i;
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+template <class Tree>
+static void scaling(const char* variant, size_t n, mt19937& rng) {
+    vector<int> keys = shuffledKeys(n, rng);
+
+    Tree tree;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        tree.insert(keys[i], keys[i]);
+    }
+    report("insert", variant, n, elapsedNs(start));
+
+    shuffle(keys.begin(), keys.end(), rng);
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        sum += tree.find(keys[i])->data;
+    }
+    report("find", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    for (typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->data;
+    }
+    report("scan", variant, n, elapsedNs(start));
+
+    shuffle(keys.begin(), keys.end(), rng);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        tree.erase(keys[i]);
+    }
+    report("erase", variant, n, elapsedNs(start));
+
+    if (sum == 42) {
+        cout << endl;
+    }
+}
+
+template <class Tree>
+static void allocation(const char* variant, size_t n, mt19937& rng) {
+    vector<int> keys = shuffledKeys(n, rng);
+
+    Tree* tree = new Tree();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        tree->insert(keys[i], keys[i]);
+    }
+    report("load", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = rng() % n;
+        tree->erase(keys[victim]);
+        keys[victim] += (int) n;
+        tree->insert(keys[victim], keys[victim]);
+    }
+    report("churn", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    delete tree;
+    report("teardown", variant, n, elapsedNs(start));
+}
+
+template <class Tree>
+static void startup(const char* variant, size_t n, mt19937& rng) {
+    vector<pair<int, int> > dump(n);
+    for (size_t i = 0; i < n; i++) {
+        dump[i] = make_pair((int) (2 * i), (int) i);
+    }
+    vector<pair<int, int> > batch(n);
+    for (size_t i = 0; i < n; i++) {
+        batch[i] = make_pair((int) (2 * i + 1), (int) i);
+    }
+    shuffle(batch.begin(), batch.end(), rng);
+
+    Tree* tree = new Tree();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        tree->insert(dump[i].first, dump[i].second);
+    }
+    report("load-insert", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        tree->insert(batch[i].first, batch[i].second);
+    }
+    report("merge-insert", variant, n, elapsedNs(start));
+    delete tree;
+
+    tree = new Tree();
+    start = chrono::steady_clock::now();
+    tree->bulkLoad(dump.begin(), dump.end());
+    report("load-bulk", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    tree->insertMany(batch.begin(), batch.end());
+    report("merge-batch", variant, n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    tree->save("avl_bench.tmp");
+    report("save", variant, 2 * n, elapsedNs(start));
+    delete tree;
+
+    tree = new Tree();
+    start = chrono::steady_clock::now();
+    tree->load("avl_bench.tmp");
+    report("load-file", variant, 2 * n, elapsedNs(start));
+    delete tree;
+    remove("avl_bench.tmp");
+}
+
+static void lookup(size_t n, mt19937& rng) {
+    vector<pair<int, int> > dump(n);
+    for (size_t i = 0; i < n; i++) {
+        dump[i] = make_pair((int) (2 * i), (int) i);
+    }
+    AVLTree<int, int, AVLPoolAllocator> tree;
+    tree.bulkLoad(dump.begin(), dump.end());
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    AVLFrozenIndex<int, int> index = tree.freeze();
+    report("freeze", "frozen", n, elapsedNs(start));
+
+    vector<int> probes(n);
+    for (size_t i = 0; i < n; i++) {
+        probes[i] = (int) (2 * (rng() % n));
+    }
+
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        sum += tree.find(probes[i])->data;
+    }
+    report("lookup", "tree", n, elapsedNs(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        sum += *index.find(probes[i]);
+    }
+    report("lookup", "frozen", n, elapsedNs(start));
+
+    if (sum == 42) {
+        cout << endl;
+    }
+}
+
+/**
+ * Fills the two trees with n keys each, drawn at random from 0..2n-1
+ * without repetition.
+ */
+template <class Tree>
+static void shards(Tree& a, Tree& b, size_t n, mt19937& rng) {
+    vector<int> keys = shuffledKeys(2 * n, rng);
+    vector<pair<int, int> > left(n);
+    vector<pair<int, int> > right(n);
+    for (size_t i = 0; i < n; i++) {
+        left[i] = make_pair(keys[i], keys[i]);
+        right[i] = make_pair(keys[n + i], keys[n + i]);
+    }
+    sort(left.begin(), left.end());
+    sort(right.begin(), right.end());
+    a.bulkLoad(left.begin(), left.end());
+    b.bulkLoad(right.begin(), right.end());
+}
+
+static void merging(size_t n, mt19937& rng) {
+    typedef AVLTree<int, int> Tree;
+    unsigned int cores = thread::hardware_concurrency();
+    if (cores < 1) {
+        cores = 1;
+    }
+
+    Tree a;
+    Tree b;
+    shards(a, b, n, rng);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (Tree::const_iterator it = b.begin(); it != b.end(); ++it) {
+        a.insert(it->key, it->data);
+    }
+    report("union", "insert", n, elapsedNs(start));
+
+    unsigned int threadCounts[] = {1, cores};
+    const char* variants[] = {"1-thread", "all-cores"};
+    for (size_t v = 0; v < 2; v++) {
+        Tree c;
+        Tree d;
+        shards(c, d, n, rng);
+        start = chrono::steady_clock::now();
+        c.unionWith(d, threadCounts[v]);
+        report("union", variants[v], n, elapsedNs(start));
+
+        Tree e;
+        Tree f;
+        shards(e, f, n, rng);
+        start = chrono::steady_clock::now();
+        c.intersect(e, threadCounts[v]);
+        report("intersect", variants[v], n, elapsedNs(start));
+
+        start = chrono::steady_clock::now();
+        e.difference(f, threadCounts[v]);
+        report("difference", variants[v], n, elapsedNs(start));
+    }
+}
+
+/**
+ * The mutex-wrapped AVLTree the concurrent tree is measured against.
+ */
+class LockedTree {
+private:
+    AVLTree<int, int> tree;
+    mutex lock;
+public:
+    bool find(int key, int& data) {
+        lock_guard<mutex> guard(this->lock);
+        AVLTree<int, int>::iterator it = this->tree.find(key);
+        if (it == this->tree.end()) {
+            return false;
+        }
+        data = it->data;
+        return true;
+    }
+
+    void insert(int key, int data) {
+        lock_guard<mutex> guard(this->lock);
+        this->tree.insert(key, data);
+    }
+
+    void erase(int key) {
+        lock_guard<mutex> guard(this->lock);
+        this->tree.erase(key);
+    }
+};
+
+template <class Tree>
+static void threads(const char* variant, size_t n, unsigned int threadCount, unsigned int readPercent) {
+    Tree tree;
+    for (size_t i = 0; i < n; i++) {
+        tree.insert((int) i, (int) i);
+    }
+
+    const size_t opsPerThread = 200000;
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int t = 0; t < threadCount; t++) {
+        workers.push_back(thread([&tree, n, t, readPercent, opsPerThread]() {
+            mt19937 rng(t);
+            int data = 0;
+            for (size_t i = 0; i < opsPerThread; i++) {
+                int key = (int) (rng() % n);
+                unsigned int dice = rng() % 100;
+                if (dice < readPercent) {
+                    tree.find(key, data);
+                } else if (dice % 2) {
+                    tree.insert(key, key);
+                } else {
+                    tree.erase(key);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    double seconds = elapsedNs(start) / 1e9;
+    cout << "threads-" << readPercent << "/" << (100 - readPercent) << "\t" << variant << "\t" << threadCount
+         << "\t" << opsPerThread * threadCount / seconds << " ops/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    size_t limit = 10000000;
+    if (argc > 1) {
+        limit = strtoul(argv[1], NULL, 10);
+    }
+
+    mt19937 rng(42);
+    cout << "op\tvariant\tn\tns/op\tns/op/log2(n)" << endl;
+    for (size_t n = 1000; n <= limit; n *= 10) {
+        scaling<AVLTree<int, int> >("new", n, rng);
+    }
+    for (size_t n = 1000; n <= limit; n *= 10) {
+        allocation<AVLTree<int, int> >("new", n, rng);
+        allocation<AVLTree<int, int, AVLPoolAllocator> >("pool", n, rng);
+    }
+    for (size_t n = 1000000; n <= limit; n *= 10) {
+        startup<AVLTree<int, int> >("new", n, rng);
+        startup<AVLTree<int, int, AVLPoolAllocator> >("pool", n, rng);
+    }
+    for (size_t n = 1000000; n <= limit; n *= 10) {
+        lookup(n, rng);
+    }
+    for (size_t n = 1000000; n <= limit; n *= 10) {
+        merging(n, rng);
+    }
+
+    size_t shared = limit < 1000000 ? limit : 1000000;
+    unsigned int mixes[] = {100, 95, 50};
+    for (size_t m = 0; m < 3; m++) {
+        for (unsigned int t = 1; t <= 64; t *= 2) {
+            threads<LockedTree>("mutex", shared, t, mixes[m]);
+            threads<ConcurrentAVLTree<int, int> >("concurrent", shared, t, mixes[m]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,527 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "avl_tree.h"
+
+using namespace std;
+
+/**
+ * Benchmark suite comparing AVLTree against std::map,
+ * std::unordered_map and a sorted vector.  AVLTree also runs with the
+ * AVLCountingStats policy ("AVLTree+stats") to show what the counters
+ * cost.
+ *
+ * Every combination of container, key/value type and key distribution
+ * runs in its own forked process, so that the peak RSS reported for it
+ * is its own.  Each run measures, in this order: insert, find of
+ * present keys, find of absent keys, a mixed workload (50% find, 25%
+ * insert, 25% erase), a full iteration and finally erasing every key.
+ *
+ * Types: int/int, uint64_t/64-byte payload and string/string, with
+ * "track-000000123456" style keys sharing a long prefix.
+ *
+ * Distributions decide the order of inserts and erases and which keys
+ * are probed: uniform (random order, uniform probes), sequential
+ * (ascending inserts and probes), zipf (random order, probes following
+ * a Zipf distribution with theta 0.99 over the keys) and adversarial
+ * (inserts, erases and probes alternating between the smallest and the
+ * largest remaining key).
+ *
+ * Output is one tab-separated line per measurement, preceded by a
+ * header, so runs can be diffed or loaded into a spreadsheet:
+ *
+ *   container type distribution op n ops_per_sec p50_ns p99_ns peak_rss_kb
+ *
+ * Latencies are taken from every sixteenth operation, timed on its
+ * own; throughput is taken over the whole phase.  Iteration counts
+ * every element visited as one operation.  The sorted vector is
+ * built by appending and sorting, and its per-key insert and erase are
+ * only measured up to 100000 keys since they cost O(n) each.
+ *
+ * Build with: g++ -O2 -std=c++11 avl_compare.cpp -o avl_compare
+ * Run with:   ./avl_compare [n] > results.tsv   (n defaults to 1000000)
+ */
+
+struct Payload {
+    uint64_t fields[8];
+};
+
+static uint64_t touch(int value) {
+    return value;
+}
+
+static uint64_t touch(const Payload& value) {
+    return value.fields[0];
+}
+
+static uint64_t touch(const string& value) {
+    return value.size();
+}
+
+/**
+ * Keys are built from an index so that ordering the indices orders
+ * the keys.  Even indices are stored, odd ones are used for misses.
+ */
+template <class K>
+static K makeKey(uint64_t);
+
+template <>
+int makeKey<int>(uint64_t i) {
+    return (int) i;
+}
+
+template <>
+uint64_t makeKey<uint64_t>(uint64_t i) {
+    return i * 1000003;
+}
+
+template <>
+string makeKey<string>(uint64_t i) {
+    ostringstream ss;
+    ss << "track-" << setw(12) << setfill('0') << i;
+    return ss.str();
+}
+
+template <class V>
+static V makeValue(uint64_t);
+
+template <>
+int makeValue<int>(uint64_t i) {
+    return (int) i;
+}
+
+template <>
+Payload makeValue<Payload>(uint64_t i) {
+    Payload payload;
+    for (size_t j = 0; j < 8; j++) {
+        payload.fields[j] = i + j;
+    }
+    return payload;
+}
+
+template <>
+string makeValue<string>(uint64_t i) {
+    ostringstream ss;
+    ss << "value-" << i;
+    return ss.str();
+}
+
+/**
+ * Adapters giving every container the same small interface.
+ */
+template <class K, class V, class Tree = AVLTree<K, V> >
+class AVLAdapter {
+private:
+    Tree tree;
+public:
+    static const bool incremental = true;
+
+    void insert(const K& key, const V& data) {
+        this->tree.insert(key, data);
+    }
+
+    void finish() {
+    }
+
+    bool find(const K& key) {
+        return this->tree.find(key) != this->tree.end();
+    }
+
+    void erase(const K& key) {
+        this->tree.erase(key);
+    }
+
+    uint64_t scan() {
+        uint64_t sum = 0;
+        for (typename Tree::const_iterator it = this->tree.begin(); it != this->tree.end(); ++it) {
+            sum += touch(it->data);
+        }
+        return sum;
+    }
+};
+
+template <class K, class V>
+class MapAdapter {
+private:
+    map<K, V> container;
+public:
+    static const bool incremental = true;
+
+    void insert(const K& key, const V& data) {
+        this->container[key] = data;
+    }
+
+    void finish() {
+    }
+
+    bool find(const K& key) {
+        return this->container.find(key) != this->container.end();
+    }
+
+    void erase(const K& key) {
+        this->container.erase(key);
+    }
+
+    uint64_t scan() {
+        uint64_t sum = 0;
+        for (typename map<K, V>::const_iterator it = this->container.begin(); it != this->container.end(); ++it) {
+            sum += touch(it->second);
+        }
+        return sum;
+    }
+};
+
+template <class K, class V>
+class UnorderedMapAdapter {
+private:
+    unordered_map<K, V> container;
+public:
+    static const bool incremental = true;
+
+    void insert(const K& key, const V& data) {
+        this->container[key] = data;
+    }
+
+    void finish() {
+    }
+
+    bool find(const K& key) {
+        return this->container.find(key) != this->container.end();
+    }
+
+    void erase(const K& key) {
+        this->container.erase(key);
+    }
+
+    uint64_t scan() {
+        uint64_t sum = 0;
+        for (typename unordered_map<K, V>::const_iterator it = this->container.begin(); it != this->container.end(); ++it) {
+            sum += touch(it->second);
+        }
+        return sum;
+    }
+};
+
+template <class K, class V>
+class SortedVectorAdapter {
+private:
+    vector<pair<K, V> > container;
+
+    static bool keyLess(const pair<K, V>& entry, const K& key) {
+        return entry.first < key;
+    }
+
+    static bool entryLess(const pair<K, V>& a, const pair<K, V>& b) {
+        return a.first < b.first;
+    }
+
+    typename vector<pair<K, V> >::iterator position(const K& key) {
+        return lower_bound(this->container.begin(), this->container.end(), key, keyLess);
+    }
+public:
+    static const bool incremental = false;
+
+    /**
+     * Only used to build the vector; finish() puts it in order.
+     */
+    void insert(const K& key, const V& data) {
+        this->container.push_back(make_pair(key, data));
+    }
+
+    void finish() {
+        stable_sort(this->container.begin(), this->container.end(), entryLess);
+    }
+
+    void insertSorted(const K& key, const V& data) {
+        typename vector<pair<K, V> >::iterator it = this->position(key);
+        if (it != this->container.end() && !(key < it->first)) {
+            it->second = data;
+        } else {
+            this->container.insert(it, make_pair(key, data));
+        }
+    }
+
+    bool find(const K& key) {
+        typename vector<pair<K, V> >::iterator it = this->position(key);
+        return it != this->container.end() && !(key < it->first);
+    }
+
+    void erase(const K& key) {
+        typename vector<pair<K, V> >::iterator it = this->position(key);
+        if (it != this->container.end() && !(key < it->first)) {
+            this->container.erase(it);
+        }
+    }
+
+    uint64_t scan() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < this->container.size(); i++) {
+            sum += touch(this->container[i].second);
+        }
+        return sum;
+    }
+};
+
+/**
+ * Per-key insert that also works for the sorted vector once it has
+ * been built.
+ */
+template <class A, class K, class V>
+static void insertOne(A& adapter, const K& key, const V& data) {
+    adapter.insert(key, data);
+}
+
+template <class K, class V>
+static void insertOne(SortedVectorAdapter<K, V>& adapter, const K& key, const V& data) {
+    adapter.insertSorted(key, data);
+}
+
+/**
+ * Returns the order in which the n stored keys are inserted and
+ * erased, as indices into the key space.
+ */
+static vector<uint64_t> insertOrder(const string& distribution, size_t n, mt19937_64& rng) {
+    vector<uint64_t> order(n);
+    if (distribution == "adversarial") {
+        for (size_t i = 0, lo = 0, hi = n; i < n; i++) {
+            order[i] = (i % 2) ? --hi : lo++;
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        if (distribution != "sequential") {
+            shuffle(order.begin(), order.end(), rng);
+        }
+    }
+    return order;
+}
+
+/**
+ * Returns n probe positions in [0, n) following the distribution.
+ */
+static vector<uint64_t> probeOrder(const string& distribution, size_t n, mt19937_64& rng) {
+    vector<uint64_t> probes(n);
+    if (distribution == "sequential") {
+        for (size_t i = 0; i < n; i++) {
+            probes[i] = i;
+        }
+    } else if (distribution == "adversarial") {
+        for (size_t i = 0; i < n; i++) {
+            probes[i] = (i % 2) ? n - 1 - i / 2 : i / 2;
+        }
+    } else if (distribution == "zipf") {
+        // Inverse transform over the cumulative distribution, with
+        // ranks mapped to random positions so the hot keys are spread
+        // over the key space.
+        vector<double> cdf(n);
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow((double) (i + 1), 0.99);
+            cdf[i] = sum;
+        }
+        vector<uint64_t> ranked(n);
+        for (size_t i = 0; i < n; i++) {
+            ranked[i] = i;
+        }
+        shuffle(ranked.begin(), ranked.end(), rng);
+        uniform_real_distribution<double> uniform(0, sum);
+        for (size_t i = 0; i < n; i++) {
+            size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+            probes[i] = ranked[rank < n ? rank : n - 1];
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            probes[i] = rng() % n;
+        }
+    }
+    return probes;
+}
+
+/**
+ * Collects the timings of one phase and prints its result line.
+ */
+class Phase {
+private:
+    const char* label;
+    size_t operations;
+    vector<double> samples;
+    chrono::steady_clock::time_point start;
+public:
+    Phase(const char* label) {
+        this->label = label;
+        this->operations = 0;
+        this->start = chrono::steady_clock::now();
+    }
+
+    /**
+     * Runs one operation, timing it on its own every sixteenth time.
+     * An operation covering several items, like a scan, counts as that
+     * many operations and its time is spread over them.
+     */
+    template <class F>
+    void run(F operation, size_t items = 1) {
+        if (this->operations % 16 == 0) {
+            chrono::steady_clock::time_point before = chrono::steady_clock::now();
+            operation();
+            this->samples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - before).count() / items);
+        } else {
+            operation();
+        }
+        this->operations += items;
+    }
+
+    void report(const string& prefix) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - this->start).count();
+        double p50 = 0;
+        double p99 = 0;
+        if (!this->samples.empty()) {
+            sort(this->samples.begin(), this->samples.end());
+            p50 = this->samples[this->samples.size() / 2];
+            p99 = this->samples[(this->samples.size() * 99) / 100];
+        }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        cout << prefix << "\t" << this->label << "\t" << this->operations << "\t"
+             << fixed << setprecision(0) << this->operations / seconds << "\t"
+             << setprecision(1) << p50 << "\t" << p99 << "\t" << usage.ru_maxrss << endl;
+    }
+};
+
+template <class A, class K, class V>
+static void runCase(const string& prefix, const string& distribution, size_t n) {
+    mt19937_64 rng(42);
+    vector<uint64_t> order = insertOrder(distribution, n, rng);
+    vector<uint64_t> probes = probeOrder(distribution, n, rng);
+    vector<K> keys(n);
+    vector<K> misses(n);
+    vector<V> values(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = makeKey<K>(2 * i);
+        misses[i] = makeKey<K>(2 * i + 1);
+        values[i] = makeValue<V>(i);
+    }
+
+    A adapter;
+    uint64_t found = 0;
+    {
+        Phase phase("insert");
+        for (size_t i = 0; i < n; i++) {
+            const K& key = keys[order[i]];
+            const V& value = values[order[i]];
+            phase.run([&]() { adapter.insert(key, value); });
+        }
+        adapter.finish();
+        phase.report(prefix);
+    }
+    {
+        Phase phase("find-hit");
+        for (size_t i = 0; i < n; i++) {
+            const K& key = keys[probes[i]];
+            phase.run([&]() { found += adapter.find(key); });
+        }
+        phase.report(prefix);
+    }
+    {
+        Phase phase("find-miss");
+        for (size_t i = 0; i < n; i++) {
+            const K& key = misses[probes[i]];
+            phase.run([&]() { found += adapter.find(key); });
+        }
+        phase.report(prefix);
+    }
+    if (A::incremental || n <= 100000) {
+        Phase phase("mixed");
+        for (size_t i = 0; i < n; i++) {
+            size_t index = probes[i];
+            const K& key = keys[index];
+            const V& value = values[index];
+            switch (rng() % 4) {
+            case 0:
+                phase.run([&]() { insertOne(adapter, key, value); });
+                break;
+            case 1:
+                phase.run([&]() { adapter.erase(key); });
+                break;
+            default:
+                phase.run([&]() { found += adapter.find(key); });
+            }
+        }
+        phase.report(prefix);
+    }
+    {
+        Phase phase("iterate");
+        phase.run([&]() { found += adapter.scan(); }, n);
+        phase.report(prefix);
+    }
+    if (A::incremental || n <= 100000) {
+        Phase phase("erase");
+        for (size_t i = 0; i < n; i++) {
+            const K& key = keys[order[i]];
+            phase.run([&]() { adapter.erase(key); });
+        }
+        phase.report(prefix);
+    }
+
+    if (found == 42) {
+        cerr << endl;
+    }
+}
+
+/**
+ * Runs one case in a child process so its peak RSS is its own.
+ */
+template <class A, class K, class V>
+static void isolate(const char* container, const char* type, const char* distribution, size_t n) {
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        runCase<A, K, V>(string(container) + "\t" + type + "\t" + distribution, distribution, n);
+        cout.flush();
+        _exit(0);
+    } else if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+    } else {
+        cerr << "fork failed" << endl;
+    }
+}
+
+template <class K, class V>
+static void runType(const char* type, size_t n) {
+    const char* distributions[] = {"uniform", "sequential", "zipf", "adversarial"};
+    for (size_t d = 0; d < 4; d++) {
+        isolate<AVLAdapter<K, V>, K, V>("AVLTree", type, distributions[d], n);
+        isolate<AVLAdapter<K, V, AVLTree<K, V, AVLNewAllocator, AVLCompare<K>, AVLCountingStats> >, K, V>("AVLTree+stats", type, distributions[d], n);
+        isolate<MapAdapter<K, V>, K, V>("map", type, distributions[d], n);
+        isolate<UnorderedMapAdapter<K, V>, K, V>("unordered_map", type, distributions[d], n);
+        isolate<SortedVectorAdapter<K, V>, K, V>("sorted_vector", type, distributions[d], n);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t n = 1000000;
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    cout << "container\ttype\tdistribution\top\tn\tops_per_sec\tp50_ns\tp99_ns\tpeak_rss_kb" << endl;
+    runType<int, int>("int/int", n);
+    runType<uint64_t, Payload>("uint64_t/payload", n);
+    runType<string, string>("string/string", n);
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef _AVL_FROZEN_H
+#define _AVL_FROZEN_H
+
+#include <cstddef>
+#include <vector>
+#include "avl_key.h"
+
+using namespace std;
+
+/**
+ * An immutable, read-only copy of an AVL tree for read-heavy use,
+ * produced by AVLTree::freeze().  The keys are stored in one
+ * contiguous array in Eytzinger (breadth-first) order: the children
+ * of slot k are slots 2k and 2k + 1.  A lookup therefore walks a
+ * single array from the front, the top levels of every search share
+ * the same few cache lines, and the slots a search might need several
+ * levels down are adjacent so they can be prefetched.  Values live in
+ * a parallel array and are only touched on a hit.  Keys are ordered
+ * by the same three-way comparator as the tree they were copied from.
+ */
+template <class T, class U, class Compare = AVLCompare<T> >
+class AVLFrozenIndex {
+private:
+    /**
+     * Keys in Eytzinger order, starting at slot 1.  Slot 0 is unused.
+     */
+    vector<T> keys;
+
+    /**
+     * Values in the same order as the keys.
+     */
+    vector<U> values;
+
+    /**
+     * Orders the keys.
+     */
+    Compare compare;
+
+    /**
+     * How many slots ahead, in the Eytzinger order, a cache line
+     * reaches.  Prefetching slot k * span pulls in all descendants of
+     * slot k that lie that many levels down.
+     */
+    static const size_t span = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+    /**
+     * Fills the slots of the subtree rooted at the given slot from the
+     * sorted input, in order.
+     */
+    template <class I>
+    void fill(size_t, I&);
+
+    /**
+     * Returns the slot of the first key not less than the given key,
+     * or 0 if there is none.
+     */
+    template <class K>
+    size_t lowerBound(const K&) const;
+public:
+    /**
+     * Constructs an empty index.
+     */
+    AVLFrozenIndex();
+
+    /**
+     * Builds the index from a range of n nodes in key order, as given
+     * by the iterators of the tree, and the comparator that ordered
+     * them.
+     */
+    template <class I>
+    AVLFrozenIndex(I first, size_t n, const Compare& compare = Compare());
+
+    /**
+     * Returns the number of entries.
+     */
+    size_t size() const;
+
+    /**
+     * Returns a pointer to the value stored under the given key, or
+     * NULL if there is none.  The search is branch-free apart from the
+     * loop itself and prefetches several levels ahead.
+     */
+    template <class K>
+    const U* find(const K& key) const;
+};
+
+
+template <class T, class U, class Compare>
+AVLFrozenIndex<T, U, Compare>::AVLFrozenIndex() : keys(1), values(1) {
+}
+
+template <class T, class U, class Compare>
+template <class I>
+AVLFrozenIndex<T, U, Compare>::AVLFrozenIndex(I first, size_t n, const Compare& compare) : keys(n + 1), values(n + 1), compare(compare) {
+    this->fill(1, first);
+}
+
+template <class T, class U, class Compare>
+template <class I>
+void AVLFrozenIndex<T, U, Compare>::fill(size_t slot, I& it) {
+    if (slot >= this->keys.size()) {
+        return;
+    }
+
+    this->fill(2 * slot, it);
+    this->keys[slot] = it->key;
+    this->values[slot] = it->data;
+    ++it;
+    this->fill(2 * slot + 1, it);
+}
+
+template <class T, class U, class Compare>
+size_t AVLFrozenIndex<T, U, Compare>::size() const {
+    return this->keys.size() - 1;
+}
+
+template <class T, class U, class Compare>
+template <class K>
+size_t AVLFrozenIndex<T, U, Compare>::lowerBound(const K& key) const {
+    const T* base = &this->keys[0];
+    size_t n = this->keys.size() - 1;
+    size_t slot = 1;
+
+    while (slot <= n) {
+        if (slot * span <= n) {
+            __builtin_prefetch(base + slot * span);
+        }
+        slot = 2 * slot + (this->compare(key, base[slot]) > 0);
+    }
+
+    // Every step to the right appended a 1 bit and every step to the
+    // left a 0 bit; the answer is where the last left step was taken.
+    return slot >> __builtin_ffsll(~(unsigned long long) slot);
+}
+
+template <class T, class U, class Compare>
+template <class K>
+const U* AVLFrozenIndex<T, U, Compare>::find(const K& key) const {
+    size_t slot = this->lowerBound(key);
+    if (slot == 0 || this->compare(key, this->keys[slot]) != 0) {
+        return NULL;
+    }
+
+    return &this->values[slot];
+}
+
+#endif
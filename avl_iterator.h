@@ -0,0 +1,212 @@
+#ifndef _AVL_ITERATOR_H
+#define _AVL_ITERATOR_H
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include "avl_node.h"
+
+using namespace std;
+
+/**
+ * The entry of a node as seen through an iterator.  Like the key of a
+ * std::map entry, the key is const, since changing it would break the
+ * order of the tree; the data can be written through mutable
+ * iterators, and V is const U for const ones.
+ */
+template <class T, class V>
+struct AVLEntry {
+    const T& key;
+    V& data;
+
+    AVLEntry(const T& key, V& data) : key(key), data(data) {}
+};
+
+template <class T, class U, template <class> class, class, class> class AVLTree;
+
+/**
+ * A bidirectional iterator over the nodes of an AVL tree, in key
+ * order.  It walks the parent links of the nodes, so stepping needs
+ * neither recursion nor a stack and never allocates.  N is either
+ * AVLNode<T, U> or const AVLNode<T, U>.  Dereferencing yields an
+ * AVLEntry, so the links and key of the node stay out of reach.
+ *
+ * The iterator also remembers where the tree keeps its root so that
+ * end() can be decremented to reach the last node.
+ */
+template <class T, class U, class N>
+class AVLIterator {
+private:
+    typedef AVLEntry<T, typename conditional<is_const<N>::value, const U, U>::type> entry_type;
+
+    /**
+     * The node currently pointed at, NULL for the end position.
+     */
+    N* node;
+
+    /**
+     * The root slot of the tree being iterated.
+     */
+    AVLNode<T, U>* const* root;
+
+    template <class, class, class> friend class AVLIterator;
+    template <class, class, template <class> class, class, class> friend class AVLTree;
+public:
+    /**
+     * What operator-> returns: holds the entry, whose members the
+     * arrow then reaches.
+     */
+    class arrow_proxy {
+    private:
+        entry_type entry;
+    public:
+        arrow_proxy(const entry_type& entry) : entry(entry) {}
+        const entry_type* operator->() const { return &this->entry; }
+    };
+
+    typedef bidirectional_iterator_tag iterator_category;
+    typedef entry_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef arrow_proxy pointer;
+    typedef entry_type reference;
+
+    /**
+     * Constructs an iterator that does not point into any tree.
+     */
+    AVLIterator();
+
+    /**
+     * Constructs an iterator at the given node of the tree whose root
+     * slot is given.
+     */
+    AVLIterator(N*, AVLNode<T, U>* const*);
+
+    /**
+     * Converts a mutable iterator into a const one.
+     */
+    template <class M>
+    AVLIterator(const AVLIterator<T, U, M>&);
+
+    entry_type operator*() const;
+    arrow_proxy operator->() const;
+
+    /**
+     * Steps to the in-order successor.
+     */
+    AVLIterator& operator++();
+    AVLIterator operator++(int);
+
+    /**
+     * Steps to the in-order predecessor; from end() this is the node
+     * with the largest key.
+     */
+    AVLIterator& operator--();
+    AVLIterator operator--(int);
+
+    template <class M>
+    bool operator==(const AVLIterator<T, U, M>&) const;
+
+    template <class M>
+    bool operator!=(const AVLIterator<T, U, M>&) const;
+};
+
+
+template <class T, class U, class N>
+AVLIterator<T, U, N>::AVLIterator() {
+    this->node = NULL;
+    this->root = NULL;
+}
+
+template <class T, class U, class N>
+AVLIterator<T, U, N>::AVLIterator(N* node, AVLNode<T, U>* const* root) {
+    this->node = node;
+    this->root = root;
+}
+
+template <class T, class U, class N>
+template <class M>
+AVLIterator<T, U, N>::AVLIterator(const AVLIterator<T, U, M>& other) {
+    this->node = other.node;
+    this->root = other.root;
+}
+
+template <class T, class U, class N>
+typename AVLIterator<T, U, N>::entry_type AVLIterator<T, U, N>::operator*() const {
+    return entry_type(this->node->key, this->node->data);
+}
+
+template <class T, class U, class N>
+typename AVLIterator<T, U, N>::arrow_proxy AVLIterator<T, U, N>::operator->() const {
+    return arrow_proxy(**this);
+}
+
+template <class T, class U, class N>
+AVLIterator<T, U, N>& AVLIterator<T, U, N>::operator++() {
+    if (this->node->right) {
+        this->node = this->node->right;
+        while (this->node->left) {
+            this->node = this->node->left;
+        }
+    } else {
+        N* child = this->node;
+        this->node = this->node->parent;
+        while (this->node && this->node->right == child) {
+            child = this->node;
+            this->node = this->node->parent;
+        }
+    }
+
+    return *this;
+}
+
+template <class T, class U, class N>
+AVLIterator<T, U, N> AVLIterator<T, U, N>::operator++(int) {
+    AVLIterator<T, U, N> previous = *this;
+    ++*this;
+    return previous;
+}
+
+template <class T, class U, class N>
+AVLIterator<T, U, N>& AVLIterator<T, U, N>::operator--() {
+    if (!this->node) {
+        this->node = *this->root;
+        while (this->node->right) {
+            this->node = this->node->right;
+        }
+    } else if (this->node->left) {
+        this->node = this->node->left;
+        while (this->node->right) {
+            this->node = this->node->right;
+        }
+    } else {
+        N* child = this->node;
+        this->node = this->node->parent;
+        while (this->node && this->node->left == child) {
+            child = this->node;
+            this->node = this->node->parent;
+        }
+    }
+
+    return *this;
+}
+
+template <class T, class U, class N>
+AVLIterator<T, U, N> AVLIterator<T, U, N>::operator--(int) {
+    AVLIterator<T, U, N> previous = *this;
+    --*this;
+    return previous;
+}
+
+template <class T, class U, class N>
+template <class M>
+bool AVLIterator<T, U, N>::operator==(const AVLIterator<T, U, M>& other) const {
+    return this->node == other.node;
+}
+
+template <class T, class U, class N>
+template <class M>
+bool AVLIterator<T, U, N>::operator!=(const AVLIterator<T, U, M>& other) const {
+    return this->node != other.node;
+}
+
+#endif
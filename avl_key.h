@@ -0,0 +1,180 @@
+#ifndef _AVL_KEY_H
+#define _AVL_KEY_H
+
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * The default key comparator of AVLTree.  Comparators are three-way:
+ * they return a negative number, zero or a positive number when the
+ * probe (the first argument, any type comparable with T) is less than,
+ * equal to or greater than the stored key.  A search then compares
+ * once per level instead of trying < in both directions.
+ *
+ * The general version derives the result from operator<, which costs
+ * nothing extra for cheap keys like integers.
+ */
+template <class T>
+class AVLCompare {
+public:
+    template <class K>
+    int operator()(const K& probe, const T& key) const;
+};
+
+/**
+ * Strings are compared with a single pass over the characters.
+ */
+template <>
+class AVLCompare<string> {
+public:
+    int operator()(const string& probe, const string& key) const;
+    int operator()(const char* probe, const string& key) const;
+
+    template <class K>
+    int operator()(const K& probe, const string& key) const;
+};
+
+/**
+ * Extra per-node state derived from the key, inherited by AVLNode.
+ * Empty for general key types, so it takes up no space.
+ */
+template <class T>
+class AVLKeyPrefix {
+public:
+    void cache(const T&);
+};
+
+/**
+ * String nodes keep the first 16 bytes of their key inline, as two
+ * big-endian words padded with zeros.  Comparing those words orders
+ * two keys exactly as their first 16 bytes do, so a search only has
+ * to read a key's heap buffer when the prefixes tie.  16 bytes cover
+ * keys such as "track-123456" completely.
+ */
+template <>
+class AVLKeyPrefix<string> {
+public:
+    uint64_t prefix[2];
+
+    void cache(const string&);
+
+    /**
+     * Fills the two words from the first bytes of the key.
+     */
+    static void encode(const string&, uint64_t*);
+};
+
+/**
+ * One search for a key: compares the probe against one node after
+ * another using the tree's comparator.  Specialized below for string
+ * keys under the default comparator, which is the only ordering the
+ * cached prefixes agree with.
+ */
+template <class T, class K, class Compare>
+class AVLProbe {
+private:
+    const K& key;
+    const Compare& compare;
+public:
+    AVLProbe(const K&, const Compare&);
+
+    template <class N>
+    int against(const N*) const;
+};
+
+/**
+ * Encodes the probe's prefix once, then decides most levels on the two
+ * inline words of the node alone.
+ */
+template <>
+class AVLProbe<string, string, AVLCompare<string> > {
+private:
+    const string& key;
+    uint64_t prefix[2];
+public:
+    AVLProbe(const string&, const AVLCompare<string>&);
+
+    template <class N>
+    int against(const N*) const;
+};
+
+
+template <class T>
+template <class K>
+int AVLCompare<T>::operator()(const K& probe, const T& key) const {
+    if (probe < key) {
+        return -1;
+    }
+    return key < probe ? 1 : 0;
+}
+
+inline int AVLCompare<string>::operator()(const string& probe, const string& key) const {
+    return probe.compare(key);
+}
+
+inline int AVLCompare<string>::operator()(const char* probe, const string& key) const {
+    return -key.compare(probe);
+}
+
+template <class K>
+int AVLCompare<string>::operator()(const K& probe, const string& key) const {
+    if (probe < key) {
+        return -1;
+    }
+    return key < probe ? 1 : 0;
+}
+
+template <class T>
+void AVLKeyPrefix<T>::cache(const T&) {
+}
+
+inline void AVLKeyPrefix<string>::cache(const string& key) {
+    encode(key, this->prefix);
+}
+
+inline void AVLKeyPrefix<string>::encode(const string& key, uint64_t* words) {
+    unsigned char bytes[16] = {0};
+    memcpy(bytes, key.data(), key.size() < 16 ? key.size() : 16);
+    for (size_t i = 0; i < 2; i++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++) {
+            word = (word << 8) | bytes[8 * i + j];
+        }
+        words[i] = word;
+    }
+}
+
+template <class T, class K, class Compare>
+AVLProbe<T, K, Compare>::AVLProbe(const K& key, const Compare& compare) : key(key), compare(compare) {
+}
+
+template <class T, class K, class Compare>
+template <class N>
+int AVLProbe<T, K, Compare>::against(const N* node) const {
+    return this->compare(this->key, node->key);
+}
+
+inline AVLProbe<string, string, AVLCompare<string> >::AVLProbe(const string& key, const AVLCompare<string>&) : key(key) {
+    AVLKeyPrefix<string>::encode(key, this->prefix);
+}
+
+template <class N>
+int AVLProbe<string, string, AVLCompare<string> >::against(const N* node) const {
+    for (size_t i = 0; i < 2; i++) {
+        if (this->prefix[i] != node->prefix[i]) {
+            return this->prefix[i] < node->prefix[i] ? -1 : 1;
+        }
+    }
+
+    // Equal prefixes of keys that fit in them mean one key is the
+    // other padded with NUL bytes, so the lengths decide.
+    if (this->key.size() <= 16 && node->key.size() <= 16) {
+        return this->key.size() < node->key.size() ? -1 : (this->key.size() > node->key.size() ? 1 : 0);
+    }
+    return this->key.compare(node->key);
+}
+
+#endif
@@ -3,27 +3,34 @@
 
 #include <string>
 #include <sstream>
+#include <ostream>
+#include <iomanip>
+#include <utility>
+#include "avl_key.h"
 
 using namespace std;
 
 /**
  * A container structure used as the building block of the AVL tree.
+ * The base class caches whatever the key type wants kept next to the
+ * links for faster searches; see avl_key.h.
  */
 template <class T, class U>
-class AVLNode {
-private:
-    /**
-     * Takes a node and recursively traverses it post-order to
-     * generate a string representation of it and all children.
-     */
-    string toString(AVLNode<T, U>*, string);
+class AVLNode : public AVLKeyPrefix<T> {
 public:
     /**
-     * Pretty public interface for the private version of this method.
-     * Starts the recursive loop off.
+     * Returns the representation written by write() as a string.
      */
     string toString();
 
+    /**
+     * Streams a sideways picture of this node and all children to the
+     * given stream in one pass: right subtree first, each level
+     * indented four more spaces.  The walk follows the parent links
+     * instead of recursing and builds no intermediate strings.
+     */
+    void write(ostream&);
+
     /**
      * The node to the left of this node.
      */
@@ -34,6 +41,12 @@ public:
      */
     AVLNode *right;
 
+    /**
+     * The node above this one, NULL for the root.  Lets iterators
+     * step through the tree without recursion.
+     */
+    AVLNode *parent;
+
     /**
      * The key of the node.
      */
@@ -44,10 +57,27 @@ public:
      */
     U data;
 
+    /**
+     * The height of the subtree rooted at this node (1 + max(left,
+     * right)).  It is cached here so that balancing never has to walk
+     * a subtree; the tree keeps it current through update().
+     */
+    unsigned int height;
+
+    /**
+     * The number of nodes in the subtree rooted at this node, for
+     * order statistics.  Kept current by update() alongside the
+     * height, next to which it costs no extra space.
+     */
+    unsigned int count;
+
     /**
      * The constructor initializes the key, value, and all pointers.
+     * The key is built from the first argument and the value from the
+     * rest, both forwarded so that temporaries are moved in place.
      */
-    AVLNode(T, U);
+    template <class K, class... Args>
+    AVLNode(K&&, Args&&...);
 
     /**
      * Computes the difference between the height of the left subtree
@@ -57,85 +87,106 @@ public:
     int factor();
 
     /**
-     * Gets the height of this tree (1 + max(left, right)).
+     * Recomputes the cached height and count from the children.  Must
+     * be called bottom-up whenever a child pointer changes.
+     */
+    void update();
+
+    /**
+     * Gets the height of the given subtree, treating NULL as empty.
      */
-    unsigned int height();
+    static unsigned int heightOf(AVLNode<T, U>*);
+
+    /**
+     * Gets the node count of the given subtree, treating NULL as
+     * empty.
+     */
+    static unsigned int countOf(AVLNode<T, U>*);
 };
 
 template <class T, class U>
-AVLNode<T, U>::AVLNode(T key, U data) {
+template <class K, class... Args>
+AVLNode<T, U>::AVLNode(K&& key, Args&&... args) : key(forward<K>(key)), data(forward<Args>(args)...) {
     this->left = NULL;
     this->right = NULL;
-    this->key = key;
-    this->data = data;
+    this->parent = NULL;
+    this->height = 1;
+    this->count = 1;
+    this->cache(this->key);
 }
 
 template <class T, class U>
 int AVLNode<T, U>::factor() {
-    unsigned int leftHeight = 0;
-    unsigned int rightHeight = 0;
-
-    if (this->left) {
-        leftHeight = this->left->height();
-    }
-    if (this->right) {
-        rightHeight = this->right->height();
-    }
-
-    return leftHeight - rightHeight;
+    return (int) heightOf(this->left) - (int) heightOf(this->right);
 }
 
 template <class T, class U>
-unsigned int AVLNode<T, U>::height() {
-    unsigned int height = 1;
-    unsigned int leftHeight = 0;
-    unsigned int rightHeight = 0;
-
-    if (this->left) {
-        leftHeight = this->left->height();
-    }
-    if (this->right) {
-        rightHeight = this->right->height();
-    }
+void AVLNode<T, U>::update() {
+    unsigned int leftHeight = heightOf(this->left);
+    unsigned int rightHeight = heightOf(this->right);
 
     if (leftHeight > rightHeight) {
-        return height + leftHeight;
+        this->height = 1 + leftHeight;
     } else {
-        return height + rightHeight;
+        this->height = 1 + rightHeight;
     }
+    this->count = 1 + countOf(this->left) + countOf(this->right);
 }
 
 template <class T, class U>
-string AVLNode<T, U>::toString(AVLNode<T, U>* node, string indent) {
-    stringstream ss;
-
-    indent += "    ";
-    if (node && node->right) {
-        ss << this->toString(node->right, indent);
-    } else {
-        ss << indent << "" << endl;
-    }
+unsigned int AVLNode<T, U>::heightOf(AVLNode<T, U>* node) {
+    return node ? node->height : 0;
+}
 
-    indent = indent.substr(0, indent.size() - 4);
-    if (node) {
-        ss << indent << "" << node->key << " => " << node->data << "";
-    } else {
-        ss << indent << "" << endl;
-    }
+template <class T, class U>
+unsigned int AVLNode<T, U>::countOf(AVLNode<T, U>* node) {
+    return node ? node->count : 0;
+}
 
-    indent += "    ";
-    if (node && node->left) {
-        ss << this->toString(node->left, indent);
-    } else {
-        ss << indent << "" << endl;
+template <class T, class U>
+void AVLNode<T, U>::write(ostream& os) {
+    AVLNode<T, U>* node = this;
+    size_t depth = 0;
+    bool descend = true;
+
+    for (;;) {
+        if (descend) {
+            while (node->right) {
+                node = node->right;
+                depth++;
+            }
+            os << setw(4 * (depth + 1)) << "" << endl;
+        }
+
+        os << setw(4 * depth) << "" << node->key << " => " << node->data;
+        if (node->left) {
+            node = node->left;
+            depth++;
+            descend = true;
+            continue;
+        }
+        os << setw(4 * (depth + 1)) << "" << endl;
+
+        // Climb past every node whose left side is done; the first one
+        // reached from its right side is the next to be written.
+        while (node != this && node == node->parent->left) {
+            node = node->parent;
+            depth--;
+        }
+        if (node == this) {
+            break;
+        }
+        node = node->parent;
+        depth--;
+        descend = false;
     }
-
-    return ss.str();
 }
 
 template <class T, class U>
 string AVLNode<T, U>::toString() {
-    return this->toString(this, "");
+    stringstream ss;
+    this->write(ss);
+    return ss.str();
 }
 
 #endif
@@ -0,0 +1,153 @@
+#ifndef _AVL_SERIALIZE_H
+#define _AVL_SERIALIZE_H
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * Converts keys and values to and from the binary format written by
+ * AVLTree::save().  The general version copies the raw bytes of the
+ * object and therefore only accepts trivially copyable types; other
+ * types need a specialization like the one for strings below.  The
+ * format uses the byte order of the machine that wrote it.
+ */
+template <class T>
+class AVLSerializer {
+public:
+    /**
+     * Appends the encoding of the value to the stream.
+     */
+    static void write(ostream&, const T&);
+
+    /**
+     * Decodes a value from the buffer, which ends at the second
+     * pointer.  Returns the position just past the value, or NULL if
+     * the buffer is too short.
+     */
+    static const char* read(const char*, const char*, T&);
+
+    /**
+     * Returns the fewest bytes any encoded value takes.
+     */
+    static size_t minimumSize();
+};
+
+/**
+ * Strings are stored as a 32-bit length followed by the characters.
+ */
+template <>
+class AVLSerializer<string> {
+public:
+    static void write(ostream&, const string&);
+    static const char* read(const char*, const char*, string&);
+    static size_t minimumSize();
+};
+
+/**
+ * A read-only, private mapping of a whole file, unmapped when the
+ * object goes away.
+ */
+class AVLFileMapping {
+private:
+    void* mapping;
+    size_t length;
+
+    /**
+     * Disallow copying.
+     */
+    AVLFileMapping(const AVLFileMapping&);
+    AVLFileMapping& operator=(const AVLFileMapping&);
+public:
+    explicit AVLFileMapping(const string& filename);
+    ~AVLFileMapping();
+
+    /**
+     * Returns NULL if the file could not be opened or mapped.
+     */
+    const char* begin() const;
+    const char* end() const;
+};
+
+
+template <class T>
+void AVLSerializer<T>::write(ostream& os, const T& value) {
+    static_assert(is_trivially_copyable<T>::value, "AVLSerializer needs a specialization for this type");
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+const char* AVLSerializer<T>::read(const char* position, const char* end, T& value) {
+    static_assert(is_trivially_copyable<T>::value, "AVLSerializer needs a specialization for this type");
+    if ((size_t) (end - position) < sizeof(T)) {
+        return NULL;
+    }
+    memcpy(&value, position, sizeof(T));
+    return position + sizeof(T);
+}
+
+template <class T>
+size_t AVLSerializer<T>::minimumSize() {
+    return sizeof(T);
+}
+
+inline void AVLSerializer<string>::write(ostream& os, const string& value) {
+    uint32_t length = (uint32_t) value.size();
+    os.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    os.write(value.data(), length);
+}
+
+inline const char* AVLSerializer<string>::read(const char* position, const char* end, string& value) {
+    uint32_t length;
+    position = AVLSerializer<uint32_t>::read(position, end, length);
+    if (!position || (size_t) (end - position) < length) {
+        return NULL;
+    }
+    value.assign(position, length);
+    return position + length;
+}
+
+inline size_t AVLSerializer<string>::minimumSize() {
+    return sizeof(uint32_t);
+}
+
+inline AVLFileMapping::AVLFileMapping(const string& filename) : mapping(NULL), length(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            this->mapping = data;
+            this->length = info.st_size;
+            madvise(data, this->length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+inline AVLFileMapping::~AVLFileMapping() {
+    if (this->mapping) {
+        munmap(this->mapping, this->length);
+    }
+}
+
+inline const char* AVLFileMapping::begin() const {
+    return static_cast<const char*>(this->mapping);
+}
+
+inline const char* AVLFileMapping::end() const {
+    return this->begin() + this->length;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef _AVL_STATS_H
+#define _AVL_STATS_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * A point-in-time copy of the statistics of an AVL tree, as returned
+ * by AVLTree::statistics().  The counters cover everything since the
+ * tree was created or the statistics were last reset; height and
+ * nodes describe the tree at the time of the snapshot.
+ */
+struct AVLStatsSnapshot {
+    /**
+     * Path lengths longer than this are counted in the last bucket of
+     * the histogram.  An AVL tree of 2^32 nodes is at most 46 high.
+     */
+    static const size_t histogramSize = 64;
+
+    /**
+     * Number of searches down the tree: finds, inserts, erases,
+     * bounds and ranks.
+     */
+    uint64_t lookups;
+
+    /**
+     * Number of key comparisons made by those searches.
+     */
+    uint64_t comparisons;
+
+    uint64_t singleRotations;
+    uint64_t doubleRotations;
+    uint64_t allocations;
+    uint64_t frees;
+
+    unsigned int height;
+    size_t nodes;
+
+    /**
+     * pathLengths[k] is the number of searches that compared against
+     * k nodes on their way down.
+     */
+    uint64_t pathLengths[histogramSize];
+
+    AVLStatsSnapshot();
+
+    /**
+     * Returns the average number of comparisons per search.
+     */
+    double comparisonsPerLookup() const;
+};
+
+/**
+ * The statistics policy of AVLTree.  The tree reports every event to
+ * its policy; this default one ignores them all, and since its members
+ * are empty inline functions the calls compile to nothing.
+ */
+class AVLNoStats {
+public:
+    /**
+     * Whether the hooks may be called from several threads at once,
+     * which the parallel set operations of the tree rely on.
+     */
+    static const bool concurrent = true;
+
+    void lookup(size_t) {}
+    void singleRotation() {}
+    void doubleRotation() {}
+    void allocated() {}
+    void freed(size_t) {}
+    void reset() {}
+    void fill(AVLStatsSnapshot&) const {}
+};
+
+/**
+ * A statistics policy that counts every event with plain integers.
+ * Like the tree itself it must not be used from several threads at
+ * once, and that includes concurrent finds on a const tree.
+ */
+class AVLCountingStats {
+private:
+    AVLStatsSnapshot totals;
+public:
+    static const bool concurrent = false;
+
+    /**
+     * Records a search that compared against the given number of
+     * nodes.
+     */
+    void lookup(size_t);
+
+    void singleRotation();
+    void doubleRotation();
+    void allocated();
+    void freed(size_t);
+    void reset();
+
+    /**
+     * Copies the counters into the snapshot.
+     */
+    void fill(AVLStatsSnapshot&) const;
+};
+
+
+inline AVLStatsSnapshot::AVLStatsSnapshot() {
+    memset(this, 0, sizeof(*this));
+}
+
+inline double AVLStatsSnapshot::comparisonsPerLookup() const {
+    return this->lookups ? (double) this->comparisons / this->lookups : 0;
+}
+
+inline void AVLCountingStats::lookup(size_t length) {
+    this->totals.lookups++;
+    this->totals.comparisons += length;
+    this->totals.pathLengths[length < AVLStatsSnapshot::histogramSize ? length : AVLStatsSnapshot::histogramSize - 1]++;
+}
+
+inline void AVLCountingStats::singleRotation() {
+    this->totals.singleRotations++;
+}
+
+inline void AVLCountingStats::doubleRotation() {
+    this->totals.doubleRotations++;
+}
+
+inline void AVLCountingStats::allocated() {
+    this->totals.allocations++;
+}
+
+inline void AVLCountingStats::freed(size_t count) {
+    this->totals.frees += count;
+}
+
+inline void AVLCountingStats::reset() {
+    this->totals = AVLStatsSnapshot();
+}
+
+inline void AVLCountingStats::fill(AVLStatsSnapshot& snapshot) const {
+    snapshot = this->totals;
+}
+
+#endif
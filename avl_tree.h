@@ -2,17 +2,38 @@
 #define _AVL_TREE_H
 
 #include <string>
+#include <vector>
+#include <ostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <thread>
+#include "avl_key.h"
 #include "avl_node.h"
+#include "avl_allocator.h"
+#include "avl_iterator.h"
+#include "avl_frozen.h"
+#include "avl_serialize.h"
+#include "avl_stats.h"
 
 using namespace std;
 
 /**
  * An implementation of the AVL tree.  The types that can be used for
  * the key and value are fully generic.  The public methods of this
- * class try to mimic those of other STL containers.  The only thing
- * not really provided is iterator support.
+ * class try to mimic those of other STL containers, including
+ * bidirectional in-order iterators (see avl_iterator.h) that
+ * dereference to the entry, with a const key as in std::map.  Node storage comes from
+ * the allocator template; see avl_allocator.h.  Keys are ordered by a
+ * three-way comparator, which defaults to operator< and may be given
+ * probe types other than T; see avl_key.h.  The statistics policy
+ * counts searches, rotations and allocations when it is
+ * AVLCountingStats and costs nothing otherwise; see avl_stats.h.
  */
-template <class T, class U>
+template <class T, class U, template <class> class Alloc = AVLNewAllocator, class Compare = AVLCompare<T>, class Stats = AVLNoStats>
 class AVLTree {
 private:
     /**
@@ -20,24 +41,157 @@ private:
      */
     AVLNode<T, U>* root;
 
+    /**
+     * Where the nodes of the tree come from.
+     */
+    Alloc<AVLNode<T, U> > allocator;
+
+    /**
+     * The number of nodes in the tree.
+     */
+    size_t nodeCount;
+
+    /**
+     * Orders the keys.
+     */
+    Compare compare;
+
+    /**
+     * Receives the events counted by statistics().  Mutable because
+     * searches on a const tree are counted too.
+     */
+    mutable Stats stats;
+
+    /**
+     * Allocates and constructs a new node from the given key and value
+     * constructor arguments.
+     */
+    template <class... Args>
+    AVLNode<T, U>* createNode(Args&&...);
+
+    /**
+     * Destroys a node and returns its storage to the allocator.
+     */
+    void destroyNode(AVLNode<T, U>*);
+
     /**
      * Starting at a given node, deletes all children nodes and then
-     * the given node.
+     * the given node.  The walk follows the parent links, so it needs
+     * neither recursion nor a stack.
      */
     void clear(AVLNode<T, U>*);
 
     /**
-     * Deletes a single node, identified by its key.  The given node
-     * is the start of the search path.
+     * Inserts a node into the tree at the ideal location and
+     * re-balances the path above it.  The node is only obtained from
+     * the factory once the key turns out to be missing.  Returns the
+     * node holding the key and whether it is new.
+     */
+    template <class K, class F>
+    pair<AVLNode<T, U>*, bool> insertWith(const K&, F);
+
+    /**
+     * Returns the child pointer of the parent (or the root pointer)
+     * that links the given node into the tree.
+     */
+    AVLNode<T, U>** slotOf(AVLNode<T, U>*);
+
+    /**
+     * Walks from the given node up to the root, re-balancing every
+     * level on the way.  Since each node knows its parent, the path
+     * walked down by insert and erase never has to be remembered.
+     * The cached heights must still be those from before the change.
+     */
+    void rebalance(AVLNode<T, U>*);
+
+    /**
+     * Refreshes the cached height of a node whose children may have
+     * changed and applies whichever rotation restores the AVL
+     * property.  Returns the new root of the subtree.
+     */
+    AVLNode<T, U>* balance(AVLNode<T, U>*);
+
+    /**
+     * Returns the first node whose key is not less than (or, if the
+     * flag is set, greater than) the given key, or NULL.
+     */
+    template <class K>
+    AVLNode<T, U>* bound(const K&, bool) const;
+
+    /**
+     * Returns the node holding the given key, or NULL.  The key may be
+     * of any type that can be ordered against T.
+     */
+    template <class K>
+    AVLNode<T, U>* findNode(const K&) const;
+
+    /**
+     * Links an array of nodes, sorted by key, into a perfectly
+     * balanced subtree below the given parent and returns its root.
+     * Runs in linear time.
+     */
+    AVLNode<T, U>* link(AVLNode<T, U>**, size_t, AVLNode<T, U>*);
+
+    /**
+     * Joins two subtrees and a node whose key lies between them into
+     * one balanced subtree, in time proportional to the difference of
+     * their heights.  The building blocks below return detached
+     * subtrees whose root has no parent.
+     */
+    AVLNode<T, U>* joinNodes(AVLNode<T, U>*, AVLNode<T, U>*, AVLNode<T, U>*);
+
+    /**
+     * Joins two subtrees without a node in between.
+     */
+    AVLNode<T, U>* joinNodes(AVLNode<T, U>*, AVLNode<T, U>*);
+
+    /**
+     * Detaches the node with the smallest key from a subtree, passing
+     * it back through the reference, and returns what is left.
+     */
+    AVLNode<T, U>* removeFirst(AVLNode<T, U>*, AVLNode<T, U>*&);
+
+    /**
+     * Splits a subtree into the keys ordered before the probe and the
+     * keys ordered after it, in O(log n).  Returns the detached node
+     * matching the probe, or NULL.
+     */
+    template <class P>
+    AVLNode<T, U>* splitNodes(AVLNode<T, U>*, const P&, AVLNode<T, U>*&, AVLNode<T, U>*&);
+
+    /**
+     * The recursive steps of the set operations.  The first subtree is
+     * always this tree's and is split by the root key of the second;
+     * the halves are handled recursively, on another thread when there
+     * are threads to spare and enough keys, and joined back.  Nodes to
+     * be destroyed are collected as detached subtrees, since doing so
+     * on the spot would touch the allocator from several threads.
+     */
+    AVLNode<T, U>* unite(AVLNode<T, U>*, AVLNode<T, U>*, vector<AVLNode<T, U>*>&, unsigned int);
+    AVLNode<T, U>* intersect(AVLNode<T, U>*, const AVLNode<T, U>*, vector<AVLNode<T, U>*>&, unsigned int);
+    AVLNode<T, U>* subtract(AVLNode<T, U>*, const AVLNode<T, U>*, vector<AVLNode<T, U>*>&, unsigned int);
+
+    /**
+     * Whether a set operation step over the given number of keys may
+     * hand half of its work to another thread.
+     */
+    static bool forks(size_t, unsigned int);
+
+    /**
+     * Subproblems smaller than this are not worth a thread.
+     */
+    static const size_t parallelCutoff = 1 << 16;
+
+    /**
+     * Destroys the detached subtrees collected by a set operation.
      */
-    AVLNode<T, U>* erase(T, AVLNode<T, U>*);
+    void destroyAll(vector<AVLNode<T, U>*>&);
 
     /**
-     * Inserts a node into the tree at the ideal location and possibly
-     * re-balances the tree.  The given node is the start of the
-     * search path.
+     * Identifies the files written by save() and their format version.
      */
-    AVLNode<T, U>* insert(T, U, AVLNode<T, U>*);
+    static const char fileMagic[4];
+    static const uint32_t fileVersion = 1;
 
     /**
      * Performs a single left rotation.  The technical explanation of
@@ -63,11 +217,19 @@ private:
      */
     AVLNode<T, U>* doubleRotateRight(AVLNode<T, U>*);
 public:
+    typedef AVLIterator<T, U, AVLNode<T, U> > iterator;
+    typedef AVLIterator<T, U, const AVLNode<T, U> > const_iterator;
+
     /**
      * Constructor--initializes the tree.
      */
     AVLTree();
 
+    /**
+     * Initializes an empty tree ordered by the given comparator.
+     */
+    explicit AVLTree(const Compare& compare);
+
     /**
      * Destructor--frees all node memory.
      */
@@ -78,42 +240,241 @@ public:
      */
     string toString();
 
+    /**
+     * Streams the same representation as toString() to the given
+     * stream in a single pass.
+     */
+    void write(ostream& os);
+
+    /**
+     * Writes the entries to the given file in a compact binary format:
+     * a header with the entry count followed by the keys and values in
+     * key order, encoded by AVLSerializer.  Returns false on I/O
+     * errors.
+     */
+    bool save(const string& filename) const;
+
+    /**
+     * Replaces the contents of the tree with those of a file written by
+     * save().  The file is memory-mapped and decoded straight into
+     * nodes that are linked in linear time, as bulkLoad() does.
+     * Returns false, leaving the tree empty, if the file cannot be
+     * read or is malformed.
+     */
+    bool load(const string& filename);
+
     /**
      * Deletes all nodes in the tree.
      */
     void clear();
 
+    /**
+     * Returns the number of nodes in the tree.
+     */
+    size_t size() const;
+
+    /**
+     * Returns a copy of the counters of the statistics policy along
+     * with the current height and node count.  With the default
+     * policy only the latter two are filled in.
+     */
+    AVLStatsSnapshot statistics() const;
+
+    /**
+     * Zeroes the counters of the statistics policy.
+     */
+    void resetStatistics();
+
+    /**
+     * Replaces the contents of the tree with the key/value pairs of
+     * the given range, which must be sorted by key without duplicates.
+     * The nodes are allocated in key order and linked into a perfectly
+     * balanced tree in O(n), without any comparisons or rotations.
+     */
+    template <class I>
+    void bulkLoad(I first, I last);
+
+    /**
+     * Inserts a batch of key/value pairs in any order; a later pair
+     * wins over an earlier one with the same key, as with insert().
+     * Small batches go through insert(); larger ones are sorted and
+     * merged with the existing nodes, which are then re-linked in
+     * O(n + m log m) instead of O(m log(n + m)) with rotations.
+     */
+    template <class I>
+    void insertMany(I first, I last);
+
+    /**
+     * Copies the tree into an immutable, contiguous index that answers
+     * lookups with far fewer cache misses; see avl_frozen.h.  Later
+     * changes to the tree are not reflected in the index.
+     */
+    AVLFrozenIndex<T, U, Compare> freeze() const;
+
+    /**
+     * Moves every node of the other tree, whose keys must all be
+     * ordered after the keys of this one, to the end of this tree, in
+     * O(log n).  The other tree is left empty.
+     */
+    void join(AVLTree& other);
+
+    /**
+     * Moves the nodes whose keys are not ordered before the given key
+     * to the other tree, replacing its contents, in O(log n).  Only
+     * for allocators whose nodes can change owner one at a time.
+     */
+    template <class K>
+    void split(const K& key, AVLTree& right);
+
+    /**
+     * Moves every node of the other tree into this one; on equal keys
+     * the other tree's entry wins, as with insert().  The other tree is
+     * left empty.  With m the size of the smaller tree and n of the
+     * larger, this takes O(m log(n / m + 1)).  Given more than one
+     * thread, large inputs are split up between that many threads.
+     */
+    void unionWith(AVLTree& other, unsigned int threads = 1);
+
+    /**
+     * Keeps only the entries whose keys are also in the other tree, in
+     * the same time as unionWith().
+     */
+    void intersect(const AVLTree& other, unsigned int threads = 1);
+
+    /**
+     * Deletes the entries whose keys are in the other tree, in the same
+     * time as unionWith().
+     */
+    void difference(const AVLTree& other, unsigned int threads = 1);
+
+    /**
+     * Returns the number of keys less than the given key, in
+     * O(log n).
+     */
+    template <class K>
+    size_t rank(const K& key) const;
+
+    /**
+     * Returns an iterator to the node with the given zero-based
+     * position in key order, or end() if there are not that many
+     * nodes, in O(log n).
+     */
+    iterator select(size_t index);
+    const_iterator select(size_t index) const;
+
+    /**
+     * Returns the number of keys in [lo, hi), in O(log n).
+     */
+    template <class K>
+    size_t countRange(const K& lo, const K& hi) const;
+
     /**
      * Deletes the specified node in the tree, identified by the key.
      * A re-balance of the tree may occur.
      */
-    void erase(T key);
+    void erase(const T& key);
+
+    /**
+     * Finds the specified node in the tree, identified by the key, and
+     * returns an iterator to it or end() if there is none.  Nothing is
+     * copied: the probe can be any type comparable with T, such as a
+     * string_view or const char* for string keys.
+     */
+    template <class K>
+    iterator find(const K& key);
+    template <class K>
+    const_iterator find(const K& key) const;
+
+    /**
+     * Inserts the given key and data as a node into the tree,
+     * replacing the data if the key is already present.  A re-balance
+     * may occur.
+     */
+    void insert(const T& key, const U& data);
+    void insert(T&& key, U&& data);
+
+    /**
+     * Builds a node in place from the key and data constructor
+     * arguments and inserts it unless the key is already present, in
+     * which case the new node is discarded.  Returns the node holding
+     * the key and whether the insertion happened.
+     */
+    template <class... Args>
+    pair<iterator, bool> emplace(Args&&... args);
+
+    /**
+     * Like emplace(), but the data is only constructed if the key is
+     * missing, so a hit costs a single lookup and nothing else.
+     */
+    template <class... Args>
+    pair<iterator, bool> try_emplace(const T& key, Args&&... args);
+    template <class... Args>
+    pair<iterator, bool> try_emplace(T&& key, Args&&... args);
+
+    /**
+     * Returns an iterator to the node with the smallest key.
+     */
+    iterator begin();
+    const_iterator begin() const;
+
+    /**
+     * Returns the past-the-end iterator.
+     */
+    iterator end();
+    const_iterator end() const;
 
     /**
-     * Finds the specified node in the tree, identified by the key.
+     * Returns an iterator to the first node whose key is not less
+     * than the given key.  Together with the iterators this gives
+     * range scans in O(log n + k).
      */
-    U find(T key);
+    template <class K>
+    iterator lower_bound(const K& key);
+    template <class K>
+    const_iterator lower_bound(const K& key) const;
 
     /**
-     * Inserts the given key and data as a node into the tree.  A
-     * re-balance may occur.
+     * Returns an iterator to the first node whose key is greater than
+     * the given key.
      */
-    void insert(T key, U data);
+    template <class K>
+    iterator upper_bound(const K& key);
+    template <class K>
+    const_iterator upper_bound(const K& key) const;
+
+    /**
+     * Returns the range of nodes whose key equals the given key,
+     * which holds at most one node.
+     */
+    template <class K>
+    pair<iterator, iterator> equal_range(const K& key);
+    template <class K>
+    pair<const_iterator, const_iterator> equal_range(const K& key) const;
 };
 
 
-template <class T, class U>
-AVLTree<T, U>::AVLTree() {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+const char AVLTree<T, U, Alloc, Compare, Stats>::fileMagic[4] = {'A', 'V', 'L', 'T'};
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLTree<T, U, Alloc, Compare, Stats>::AVLTree() {
+    this->root = NULL;
+    this->nodeCount = 0;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLTree<T, U, Alloc, Compare, Stats>::AVLTree(const Compare& compare) : compare(compare) {
     this->root = NULL;
+    this->nodeCount = 0;
 }
 
-template <class T, class U>
-AVLTree<T, U>::~AVLTree() {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLTree<T, U, Alloc, Compare, Stats>::~AVLTree() {
     this->clear();
 }
 
-template <class T, class U>
-string AVLTree<T, U>::toString() {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+string AVLTree<T, U, Alloc, Compare, Stats>::toString() {
     if (this->root) {
         return this->root->toString();
     } else {
@@ -121,6 +482,108 @@ string AVLTree<T, U>::toString() {
     }
 }
 
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::write(ostream& os) {
+    if (this->root) {
+        this->root->write(os);
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+bool AVLTree<T, U, Alloc, Compare, Stats>::save(const string& filename) const {
+    ofstream output(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!output.is_open()) {
+        return false;
+    }
+
+    uint32_t version = fileVersion;
+    uint64_t count = this->nodeCount;
+    output.write(fileMagic, sizeof(fileMagic));
+    AVLSerializer<uint32_t>::write(output, version);
+    AVLSerializer<uint64_t>::write(output, count);
+    for (const_iterator it = this->begin(); it != this->end(); ++it) {
+        AVLSerializer<T>::write(output, it->key);
+        AVLSerializer<U>::write(output, it->data);
+    }
+
+    output.close();
+    return !output.fail();
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+bool AVLTree<T, U, Alloc, Compare, Stats>::load(const string& filename) {
+    this->clear();
+
+    AVLFileMapping file(filename);
+    const char* position = file.begin();
+    const char* end = file.end();
+    if (!position || (size_t) (end - position) < sizeof(fileMagic) + sizeof(uint32_t) + sizeof(uint64_t)) {
+        return false;
+    }
+
+    uint32_t version = 0;
+    uint64_t count = 0;
+    bool valid = memcmp(position, fileMagic, sizeof(fileMagic)) == 0;
+    position += sizeof(fileMagic);
+    position = AVLSerializer<uint32_t>::read(position, end, version);
+    position = AVLSerializer<uint64_t>::read(position, end, count);
+    valid = valid && version == fileVersion;
+    // A count the rest of the file cannot hold is rejected before it
+    // gets to size the node array.
+    size_t entrySize = AVLSerializer<T>::minimumSize() + AVLSerializer<U>::minimumSize();
+    valid = valid && count <= (uint64_t) (end - position) / (entrySize ? entrySize : 1);
+
+    vector<AVLNode<T, U>*> nodes;
+    if (valid) {
+        nodes.reserve(count);
+    }
+    for (uint64_t i = 0; valid && i < count; i++) {
+        T key;
+        U data;
+        position = AVLSerializer<T>::read(position, end, key);
+        if (position) {
+            position = AVLSerializer<U>::read(position, end, data);
+        }
+        // Keys must come strictly increasing, or linking them would
+        // not give a search tree.
+        if (!position || (!nodes.empty() && this->compare(nodes.back()->key, key) >= 0)) {
+            valid = false;
+            break;
+        }
+        nodes.push_back(this->createNode(move(key), move(data)));
+    }
+
+    if (!valid) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            this->destroyNode(nodes[i]);
+        }
+        this->allocator.release();
+        return false;
+    }
+
+    if (!nodes.empty()) {
+        this->root = this->link(&nodes[0], nodes.size(), NULL);
+    }
+    return true;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class... Args>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::createNode(Args&&... args) {
+    AVLNode<T, U>* node = new (this->allocator.allocate()) AVLNode<T, U>(forward<Args>(args)...);
+    this->nodeCount++;
+    this->stats.allocated();
+    return node;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::destroyNode(AVLNode<T, U>* node) {
+    node->~AVLNode<T, U>();
+    this->allocator.deallocate(node);
+    this->nodeCount--;
+    this->stats.freed(1);
+}
+
 /**
  * Rebalance operation:
  *
@@ -144,11 +607,20 @@ string AVLTree<T, U>::toString() {
  *   /     \
  *  A       B
  */
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::singleRotateLeft(AVLNode<T, U>* node) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::singleRotateLeft(AVLNode<T, U>* node) {
     AVLNode<T, U>* left = node->left;
     node->left = left->right;
+    if (node->left) {
+        node->left->parent = node;
+    }
     left->right = node;
+    left->parent = node->parent;
+    node->parent = left;
+
+    node->update();
+    left->update();
+    this->stats.singleRotation();
 
     return left;
 }
@@ -176,11 +648,20 @@ AVLNode<T, U>* AVLTree<T, U>::singleRotateLeft(AVLNode<T, U>* node) {
  *           /     \
  *          C       D
  */
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::singleRotateRight(AVLNode<T, U>* node) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::singleRotateRight(AVLNode<T, U>* node) {
     AVLNode<T, U>* right = node->right;
     node->right = right->left;
+    if (node->right) {
+        node->right->parent = node;
+    }
     right->left = node;
+    right->parent = node->parent;
+    node->parent = right;
+
+    node->update();
+    right->update();
+    this->stats.singleRotation();
 
     return right;
 }
@@ -209,8 +690,8 @@ AVLNode<T, U>* AVLTree<T, U>::singleRotateRight(AVLNode<T, U>* node) {
  *        /     \
  *       B       C
  */
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::doubleRotateLeft(AVLNode<T, U>* node) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::doubleRotateLeft(AVLNode<T, U>* node) {
     AVLNode<T, U>* five = node;
     AVLNode<T, U>* three = five->left;
     AVLNode<T, U>* four = three->right;
@@ -221,6 +702,20 @@ AVLNode<T, U>* AVLTree<T, U>::doubleRotateLeft(AVLNode<T, U>* node) {
     five->left = c;
     four->left = three;
     four->right = five;
+    four->parent = five->parent;
+    three->parent = four;
+    five->parent = four;
+    if (b) {
+        b->parent = three;
+    }
+    if (c) {
+        c->parent = five;
+    }
+
+    three->update();
+    five->update();
+    four->update();
+    this->stats.doubleRotation();
 
     return four;
 }
@@ -248,8 +743,8 @@ AVLNode<T, U>* AVLTree<T, U>::doubleRotateLeft(AVLNode<T, U>* node) {
  *   /     \
  *  B       C
  */
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::doubleRotateRight(AVLNode<T, U>* node) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::doubleRotateRight(AVLNode<T, U>* node) {
     AVLNode<T, U>* three = node;
     AVLNode<T, U>* five = three->right;
     AVLNode<T, U>* four = five->left;
@@ -260,152 +755,859 @@ AVLNode<T, U>* AVLTree<T, U>::doubleRotateRight(AVLNode<T, U>* node) {
     five->left = c;
     four->left = three;
     four->right = five;
+    four->parent = three->parent;
+    three->parent = four;
+    five->parent = four;
+    if (b) {
+        b->parent = three;
+    }
+    if (c) {
+        c->parent = five;
+    }
+
+    three->update();
+    five->update();
+    four->update();
+    this->stats.doubleRotation();
 
     return four;
 }
 
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::insert(T key, U data, AVLNode<T, U>* node) {
-    if (!node) {
-        AVLNode<T, U>* insertion = new AVLNode<T, U>(key, data);
-        node = insertion;
-    } else if (key < node->key) {
-        node->left = this->insert(key, data, node->left);
-        if (node->factor() == 2) {
-            if (node->left->factor() >= 0) {
-                node = this->singleRotateLeft(node);
-            } else if (node->left->factor() == -1) {
-                node = this->doubleRotateLeft(node);
-            }
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::balance(AVLNode<T, U>* node) {
+    if (node->left) {
+        node->left->parent = node;
+    }
+    if (node->right) {
+        node->right->parent = node;
+    }
+    node->update();
+
+    int factor = node->factor();
+    if (factor == 2) {
+        if (node->left->factor() >= 0) {
+            node = this->singleRotateLeft(node);
+        } else {
+            node = this->doubleRotateLeft(node);
         }
-    } else if (key > node->key) {
-        node->right = this->insert(key, data, node->right);
-        if (node->factor() == -2) {
-            if (node->right->factor() <= 0) {
-                node = this->singleRotateRight(node);
-            } else if (node->right->factor() == 1) {
-                node = this->doubleRotateRight(node);
-            }
+    } else if (factor == -2) {
+        if (node->right->factor() <= 0) {
+            node = this->singleRotateRight(node);
+        } else {
+            node = this->doubleRotateRight(node);
         }
-    } else {
-        node->data = data;
     }
 
     return node;
 }
 
-template <class T, class U>
-U AVLTree<T, U>::find(T key) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>** AVLTree<T, U, Alloc, Compare, Stats>::slotOf(AVLNode<T, U>* node) {
+    if (!node->parent) {
+        return &this->root;
+    } else if (node->parent->left == node) {
+        return &node->parent->left;
+    } else {
+        return &node->parent->right;
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::rebalance(AVLNode<T, U>* node) {
+    while (node) {
+        unsigned int height = node->height;
+        AVLNode<T, U>** slot = this->slotOf(node);
+        node = this->balance(node);
+        *slot = node;
+        bool settled = node->height == height;
+        node = node->parent;
+
+        // Once a subtree is back to its old height nothing above it
+        // can be out of balance; only the counts still change.
+        if (settled) {
+            break;
+        }
+    }
+
+    for (; node; node = node->parent) {
+        node->update();
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K, class F>
+pair<AVLNode<T, U>*, bool> AVLTree<T, U, Alloc, Compare, Stats>::insertWith(const K& key, F make) {
+    AVLProbe<T, K, Compare> probe(key, this->compare);
+    AVLNode<T, U>* parent = NULL;
+    AVLNode<T, U>** slot = &this->root;
+    size_t depth = 0;
+    while (*slot) {
+        parent = *slot;
+        depth++;
+        int order = probe.against(parent);
+        if (order < 0) {
+            slot = &parent->left;
+        } else if (order > 0) {
+            slot = &parent->right;
+        } else {
+            this->stats.lookup(depth);
+            return make_pair(parent, false);
+        }
+    }
+    this->stats.lookup(depth);
+
+    AVLNode<T, U>* node = make();
+    node->parent = parent;
+    *slot = node;
+    this->rebalance(parent);
+
+    return make_pair(node, true);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::findNode(const K& key) const {
+    AVLProbe<T, K, Compare> probe(key, this->compare);
     AVLNode<T, U>* node = this->root;
+    size_t depth = 0;
     while (node) {
-        if (key < node->key) {
+        depth++;
+        int order = probe.against(node);
+        if (order < 0) {
             node = node->left;
-        } else if (key > node->key) {
+        } else if (order > 0) {
             node = node->right;
         } else {
-            return node->data;
+            break;
         }
     }
 
-    return NULL;
+    this->stats.lookup(depth);
+    return node;
 }
 
-template <class T, class U>
-void AVLTree<T, U>::insert(T key, U data) {
-    this->root = this->insert(key, data, this->root);
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::find(const K& key) {
+    return iterator(this->findNode(key), &this->root);
 }
 
-template <class T, class U>
-AVLNode<T, U>* AVLTree<T, U>::erase(T key, AVLNode<T, U>* node) {
-    if (node) {
-        if (key < node->key) {
-            node->left = this->erase(key, node->left);
-            if (node->factor() == -2) {
-                node = this->singleRotateRight(node);
-            }
-        } else if (key > node->key) {
-            node->right = this->erase(key, node->right);
-            if (node->factor() == 2) {
-                node = this->singleRotateLeft(node);
-            }
-        } else {
-            AVLNode<T, U>* child;
-            AVLNode<T, U>* parent = node;
-            bool looped = false;
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::find(const K& key) const {
+    return const_iterator(this->findNode(key), &this->root);
+}
 
-            if (node->left) {
-                child = node->left;
-                while (child->right) {
-                    looped = true;
-                    parent = child;
-                    child = child->right;
-                }
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::insert(const T& key, const U& data) {
+    pair<iterator, bool> result = this->try_emplace(key, data);
+    if (!result.second) {
+        result.first->data = data;
+    }
+}
 
-                if (looped) {
-                    parent->right = NULL;
-                } else {
-                    parent->left = NULL;
-                }
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::insert(T&& key, U&& data) {
+    pair<iterator, bool> result = this->try_emplace(move(key), move(data));
+    if (!result.second) {
+        result.first->data = move(data);
+    }
+}
 
-                child->left = node->left;
-                child->right = node->right;
-                delete node;
-                node = child;
-            } else if (node->right) {
-                child = node->right;
-                while (child->left) {
-                    looped = true;
-                    parent = child;
-                    child = child->left;
-                }
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class... Args>
+pair<typename AVLTree<T, U, Alloc, Compare, Stats>::iterator, bool> AVLTree<T, U, Alloc, Compare, Stats>::emplace(Args&&... args) {
+    AVLNode<T, U>* node = this->createNode(forward<Args>(args)...);
+    pair<AVLNode<T, U>*, bool> result = this->insertWith(node->key, [node]() { return node; });
+    if (!result.second) {
+        this->destroyNode(node);
+    }
+    return make_pair(iterator(result.first, &this->root), result.second);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class... Args>
+pair<typename AVLTree<T, U, Alloc, Compare, Stats>::iterator, bool> AVLTree<T, U, Alloc, Compare, Stats>::try_emplace(const T& key, Args&&... args) {
+    pair<AVLNode<T, U>*, bool> result = this->insertWith(key, [&]() {
+        return this->createNode(key, forward<Args>(args)...);
+    });
+    return make_pair(iterator(result.first, &this->root), result.second);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class... Args>
+pair<typename AVLTree<T, U, Alloc, Compare, Stats>::iterator, bool> AVLTree<T, U, Alloc, Compare, Stats>::try_emplace(T&& key, Args&&... args) {
+    pair<AVLNode<T, U>*, bool> result = this->insertWith(key, [&]() {
+        return this->createNode(move(key), forward<Args>(args)...);
+    });
+    return make_pair(iterator(result.first, &this->root), result.second);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::erase(const T& key) {
+    AVLNode<T, U>* node = this->findNode(key);
+    if (!node) {
+        return;
+    }
+
+    AVLNode<T, U>* start;
+    if (node->left && node->right) {
+        // The in-order successor takes the place of the erased node,
+        // and re-balancing starts where it was taken from.
+        AVLNode<T, U>* successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+
+        if (successor->parent == node) {
+            start = successor;
+        } else {
+            start = successor->parent;
+            start->left = successor->right;
+            if (successor->right) {
+                successor->right->parent = start;
+            }
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        successor->left->parent = successor;
+        *this->slotOf(node) = successor;
+        successor->parent = node->parent;
+        successor->height = node->height;
+    } else {
+        AVLNode<T, U>* child = node->left ? node->left : node->right;
+        *this->slotOf(node) = child;
+        if (child) {
+            child->parent = node->parent;
+        }
+        start = node->parent;
+    }
+
+    this->destroyNode(node);
+    this->rebalance(start);
+}
 
-                if (looped) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::clear(AVLNode<T, U>* node) {
+    AVLNode<T, U>* stop = node->parent;
+    while (node != stop) {
+        if (node->left) {
+            node = node->left;
+        } else if (node->right) {
+            node = node->right;
+        } else {
+            AVLNode<T, U>* parent = node->parent;
+            if (parent) {
+                if (parent->left == node) {
                     parent->left = NULL;
                 } else {
                     parent->right = NULL;
                 }
+            }
 
-                child->left = node->left;
-                child->right = node->right;
-                delete node;
-                node = child;
+            if (Alloc<AVLNode<T, U> >::bulkRelease) {
+                node->~AVLNode<T, U>();
             } else {
-                delete node;
-                node = NULL;
+                this->destroyNode(node);
             }
+            node = parent;
+        }
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::clear() {
+    if (this->root) {
+        // Nothing needs to be visited when the allocator can drop all
+        // the storage at once and the nodes have no destructors.
+        if (!Alloc<AVLNode<T, U> >::bulkRelease || !is_trivially_destructible<AVLNode<T, U> >::value) {
+            this->clear(this->root);
+        }
+        if (Alloc<AVLNode<T, U> >::bulkRelease) {
+            this->stats.freed(this->nodeCount);
+        }
+        this->allocator.release();
+        this->root = NULL;
+        this->nodeCount = 0;
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+size_t AVLTree<T, U, Alloc, Compare, Stats>::size() const {
+    return this->nodeCount;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLStatsSnapshot AVLTree<T, U, Alloc, Compare, Stats>::statistics() const {
+    AVLStatsSnapshot snapshot;
+    this->stats.fill(snapshot);
+    snapshot.height = AVLNode<T, U>::heightOf(this->root);
+    snapshot.nodes = this->nodeCount;
+    return snapshot;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::resetStatistics() {
+    this->stats.reset();
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLFrozenIndex<T, U, Compare> AVLTree<T, U, Alloc, Compare, Stats>::freeze() const {
+    return AVLFrozenIndex<T, U, Compare>(this->begin(), this->nodeCount, this->compare);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+size_t AVLTree<T, U, Alloc, Compare, Stats>::rank(const K& key) const {
+    AVLProbe<T, K, Compare> probe(key, this->compare);
+    size_t rank = 0;
+    size_t depth = 0;
+    AVLNode<T, U>* node = this->root;
+    while (node) {
+        depth++;
+        if (probe.against(node) > 0) {
+            rank += AVLNode<T, U>::countOf(node->left) + 1;
+            node = node->right;
+        } else {
+            node = node->left;
         }
     }
 
+    this->stats.lookup(depth);
+    return rank;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::select(size_t index) {
+    AVLNode<T, U>* node = this->root;
+    while (node) {
+        size_t leftCount = AVLNode<T, U>::countOf(node->left);
+        if (index < leftCount) {
+            node = node->left;
+        } else if (index > leftCount) {
+            index -= leftCount + 1;
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+
+    return iterator(node, &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::select(size_t index) const {
+    return const_cast<AVLTree<T, U, Alloc, Compare, Stats>*>(this)->select(index);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+size_t AVLTree<T, U, Alloc, Compare, Stats>::countRange(const K& lo, const K& hi) const {
+    size_t below = this->rank(lo);
+    size_t belowHigh = this->rank(hi);
+    return belowHigh > below ? belowHigh - below : 0;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::link(AVLNode<T, U>** nodes, size_t count, AVLNode<T, U>* parent) {
+    if (!count) {
+        return NULL;
+    }
+
+    size_t middle = count / 2;
+    AVLNode<T, U>* node = nodes[middle];
+    node->parent = parent;
+    node->left = this->link(nodes, middle, node);
+    node->right = this->link(nodes + middle + 1, count - middle - 1, node);
+    node->update();
+
     return node;
 }
 
-template <class T, class U>
-void AVLTree<T, U>::erase(T key) {
-    this->root = this->erase(key, this->root);
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class I>
+void AVLTree<T, U, Alloc, Compare, Stats>::bulkLoad(I first, I last) {
+    this->clear();
+
+    vector<AVLNode<T, U>*> nodes;
+    nodes.reserve(distance(first, last));
+    for (; first != last; ++first) {
+        nodes.push_back(this->createNode(first->first, first->second));
+    }
+
+    if (!nodes.empty()) {
+        this->root = this->link(&nodes[0], nodes.size(), NULL);
+    }
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class I>
+void AVLTree<T, U, Alloc, Compare, Stats>::insertMany(I first, I last) {
+    vector<pair<T, U> > batch(first, last);
+    if (batch.empty()) {
+        return;
+    }
+
+    // Re-linking touches every existing node, so it only pays off
+    // once the batch is a sizeable fraction of the tree.
+    double depth = log2((double) (this->nodeCount + batch.size()));
+    if (batch.size() * depth < this->nodeCount) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            this->insert(batch[i].first, batch[i].second);
+        }
+        return;
+    }
+
+    const Compare& compare = this->compare;
+    stable_sort(batch.begin(), batch.end(), [&compare](const pair<T, U>& a, const pair<T, U>& b) {
+        return compare(a.first, b.first) < 0;
+    });
+
+    vector<AVLNode<T, U>*> nodes;
+    nodes.reserve(this->nodeCount + batch.size());
+    iterator it = this->begin();
+    size_t i = 0;
+    while (i < batch.size()) {
+        // Later duplicates in the batch overwrite earlier ones.
+        while (i + 1 < batch.size() && compare(batch[i].first, batch[i + 1].first) == 0) {
+            i++;
+        }
+
+        while (it != this->end() && compare(batch[i].first, it->key) > 0) {
+            nodes.push_back(it.node);
+            ++it;
+        }
+
+        if (it != this->end() && compare(batch[i].first, it->key) == 0) {
+            it->data = move(batch[i].second);
+            nodes.push_back(it.node);
+            ++it;
+        } else {
+            nodes.push_back(this->createNode(move(batch[i].first), move(batch[i].second)));
+        }
+        i++;
+    }
+    for (; it != this->end(); ++it) {
+        nodes.push_back(it.node);
+    }
+
+    this->root = this->link(&nodes[0], nodes.size(), NULL);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::joinNodes(AVLNode<T, U>* left, AVLNode<T, U>* middle, AVLNode<T, U>* right) {
+    unsigned int leftHeight = AVLNode<T, U>::heightOf(left);
+    unsigned int rightHeight = AVLNode<T, U>::heightOf(right);
+    AVLNode<T, U>* top;
+
+    // Walk down the spine of the taller subtree to the first node no
+    // more than one level taller than the other side, hang the middle
+    // node there, and re-balance on the way back up.
+    if (leftHeight > rightHeight + 1) {
+        left->right = this->joinNodes(left->right, middle, right);
+        top = this->balance(left);
+    } else if (rightHeight > leftHeight + 1) {
+        right->left = this->joinNodes(left, middle, right->left);
+        top = this->balance(right);
+    } else {
+        middle->left = left;
+        middle->right = right;
+        top = this->balance(middle);
+    }
+
+    top->parent = NULL;
+    return top;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::joinNodes(AVLNode<T, U>* left, AVLNode<T, U>* right) {
+    if (!left) {
+        return right;
+    } else if (!right) {
+        return left;
+    }
+
+    AVLNode<T, U>* first = NULL;
+    right = this->removeFirst(right, first);
+    return this->joinNodes(left, first, right);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::removeFirst(AVLNode<T, U>* node, AVLNode<T, U>*& first) {
+    if (!node->left) {
+        AVLNode<T, U>* right = node->right;
+        if (right) {
+            right->parent = NULL;
+        }
+        node->right = NULL;
+        node->parent = NULL;
+        first = node;
+        return right;
+    }
+
+    node->left = this->removeFirst(node->left, first);
+    AVLNode<T, U>* top = this->balance(node);
+    top->parent = NULL;
+    return top;
 }
 
-template <class T, class U>
-void AVLTree<T, U>::clear(AVLNode<T, U>* node) {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class P>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::splitNodes(AVLNode<T, U>* node, const P& probe, AVLNode<T, U>*& left, AVLNode<T, U>*& right) {
     if (!node) {
+        left = NULL;
+        right = NULL;
+        return NULL;
+    }
+
+    AVLNode<T, U>* below = node->left;
+    AVLNode<T, U>* above = node->right;
+    if (below) {
+        below->parent = NULL;
+    }
+    if (above) {
+        above->parent = NULL;
+    }
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+
+    int order = probe.against(node);
+    if (order == 0) {
+        left = below;
+        right = above;
+        node->update();
+        return node;
+    }
+
+    AVLNode<T, U>* found;
+    AVLNode<T, U>* rest;
+    if (order < 0) {
+        found = this->splitNodes(below, probe, left, rest);
+        right = this->joinNodes(rest, node, above);
+    } else {
+        found = this->splitNodes(above, probe, rest, right);
+        left = this->joinNodes(below, node, rest);
+    }
+    return found;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+bool AVLTree<T, U, Alloc, Compare, Stats>::forks(size_t keys, unsigned int threads) {
+    return Stats::concurrent && threads > 1 && keys >= parallelCutoff;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::unite(AVLNode<T, U>* mine, AVLNode<T, U>* theirs, vector<AVLNode<T, U>*>& dropped, unsigned int threads) {
+    if (!mine) {
+        return theirs;
+    } else if (!theirs) {
+        return mine;
+    }
+
+    AVLNode<T, U>* theirLeft = theirs->left;
+    AVLNode<T, U>* theirRight = theirs->right;
+    if (theirLeft) {
+        theirLeft->parent = NULL;
+    }
+    if (theirRight) {
+        theirRight->parent = NULL;
+    }
+
+    AVLProbe<T, T, Compare> probe(theirs->key, this->compare);
+    AVLNode<T, U>* myLeft;
+    AVLNode<T, U>* myRight;
+    AVLNode<T, U>* duplicate = this->splitNodes(mine, probe, myLeft, myRight);
+    if (duplicate) {
+        dropped.push_back(duplicate);
+    }
+
+    AVLNode<T, U>* left;
+    AVLNode<T, U>* right;
+    if (forks(AVLNode<T, U>::countOf(myLeft) + AVLNode<T, U>::countOf(theirLeft), threads)) {
+        vector<AVLNode<T, U>*> leftDropped;
+        thread worker([&]() {
+            left = this->unite(myLeft, theirLeft, leftDropped, threads / 2);
+        });
+        right = this->unite(myRight, theirRight, dropped, threads - threads / 2);
+        worker.join();
+        dropped.insert(dropped.end(), leftDropped.begin(), leftDropped.end());
+    } else {
+        left = this->unite(myLeft, theirLeft, dropped, threads);
+        right = this->unite(myRight, theirRight, dropped, threads);
+    }
+
+    return this->joinNodes(left, theirs, right);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::intersect(AVLNode<T, U>* mine, const AVLNode<T, U>* theirs, vector<AVLNode<T, U>*>& dropped, unsigned int threads) {
+    if (!mine) {
+        return NULL;
+    } else if (!theirs) {
+        dropped.push_back(mine);
+        return NULL;
+    }
+
+    AVLProbe<T, T, Compare> probe(theirs->key, this->compare);
+    AVLNode<T, U>* myLeft;
+    AVLNode<T, U>* myRight;
+    AVLNode<T, U>* match = this->splitNodes(mine, probe, myLeft, myRight);
+
+    AVLNode<T, U>* left;
+    AVLNode<T, U>* right;
+    if (forks(AVLNode<T, U>::countOf(myLeft) + AVLNode<T, U>::countOf(theirs->left), threads)) {
+        vector<AVLNode<T, U>*> leftDropped;
+        thread worker([&]() {
+            left = this->intersect(myLeft, theirs->left, leftDropped, threads / 2);
+        });
+        right = this->intersect(myRight, theirs->right, dropped, threads - threads / 2);
+        worker.join();
+        dropped.insert(dropped.end(), leftDropped.begin(), leftDropped.end());
+    } else {
+        left = this->intersect(myLeft, theirs->left, dropped, threads);
+        right = this->intersect(myRight, theirs->right, dropped, threads);
+    }
+
+    if (match) {
+        return this->joinNodes(left, match, right);
+    }
+    return this->joinNodes(left, right);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::subtract(AVLNode<T, U>* mine, const AVLNode<T, U>* theirs, vector<AVLNode<T, U>*>& dropped, unsigned int threads) {
+    if (!mine || !theirs) {
+        return mine;
+    }
+
+    AVLProbe<T, T, Compare> probe(theirs->key, this->compare);
+    AVLNode<T, U>* myLeft;
+    AVLNode<T, U>* myRight;
+    AVLNode<T, U>* match = this->splitNodes(mine, probe, myLeft, myRight);
+    if (match) {
+        dropped.push_back(match);
+    }
+
+    AVLNode<T, U>* left;
+    AVLNode<T, U>* right;
+    if (forks(AVLNode<T, U>::countOf(myLeft) + AVLNode<T, U>::countOf(theirs->left), threads)) {
+        vector<AVLNode<T, U>*> leftDropped;
+        thread worker([&]() {
+            left = this->subtract(myLeft, theirs->left, leftDropped, threads / 2);
+        });
+        right = this->subtract(myRight, theirs->right, dropped, threads - threads / 2);
+        worker.join();
+        dropped.insert(dropped.end(), leftDropped.begin(), leftDropped.end());
+    } else {
+        left = this->subtract(myLeft, theirs->left, dropped, threads);
+        right = this->subtract(myRight, theirs->right, dropped, threads);
+    }
+
+    return this->joinNodes(left, right);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::destroyAll(vector<AVLNode<T, U>*>& dropped) {
+    for (size_t i = 0; i < dropped.size(); i++) {
+        // Post-order walk over parent links, as in clear(), but always
+        // handing the storage back since the tree lives on.
+        AVLNode<T, U>* node = dropped[i];
+        AVLNode<T, U>* stop = node->parent;
+        while (node != stop) {
+            if (node->left) {
+                node = node->left;
+            } else if (node->right) {
+                node = node->right;
+            } else {
+                AVLNode<T, U>* parent = node->parent;
+                if (parent) {
+                    if (parent->left == node) {
+                        parent->left = NULL;
+                    } else {
+                        parent->right = NULL;
+                    }
+                }
+                this->destroyNode(node);
+                node = parent;
+            }
+        }
+    }
+    dropped.clear();
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::join(AVLTree& other) {
+    if (&other == this || !other.root) {
         return;
     }
 
-    if (node->left) {
-        this->clear(node->left);
+    AVLNode<T, U>* first = NULL;
+    AVLNode<T, U>* rest = this->removeFirst(other.root, first);
+    if (this->root) {
+        this->root->parent = NULL;
     }
-    if (node->right) {
-        this->clear(node->right);
+    this->root = this->joinNodes(this->root, first, rest);
+
+    this->allocator.adopt(other.allocator);
+    this->nodeCount += other.nodeCount;
+    other.root = NULL;
+    other.nodeCount = 0;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+void AVLTree<T, U, Alloc, Compare, Stats>::split(const K& key, AVLTree& right) {
+    static_assert(!Alloc<AVLNode<T, U> >::bulkRelease, "split() cannot move nodes out of a pool allocator");
+    if (&right == this) {
+        return;
+    }
+    right.clear();
+
+    AVLProbe<T, K, Compare> probe(key, this->compare);
+    AVLNode<T, U>* below;
+    AVLNode<T, U>* above;
+    AVLNode<T, U>* match = this->splitNodes(this->root, probe, below, above);
+    if (match) {
+        above = this->joinNodes(NULL, match, above);
+    }
+
+    this->root = below;
+    right.root = above;
+    right.nodeCount = AVLNode<T, U>::countOf(above);
+    this->nodeCount -= right.nodeCount;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::unionWith(AVLTree& other, unsigned int threads) {
+    if (&other == this || !other.root) {
+        return;
+    }
+
+    vector<AVLNode<T, U>*> dropped;
+    this->root = this->unite(this->root, other.root, dropped, threads);
+    this->root->parent = NULL;
+
+    this->allocator.adopt(other.allocator);
+    this->nodeCount += other.nodeCount;
+    other.root = NULL;
+    other.nodeCount = 0;
+    this->destroyAll(dropped);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::intersect(const AVLTree& other, unsigned int threads) {
+    if (&other == this) {
+        return;
     }
 
-    delete node;
+    vector<AVLNode<T, U>*> dropped;
+    this->root = this->intersect(this->root, other.root, dropped, threads);
+    if (this->root) {
+        this->root->parent = NULL;
+    }
+    this->destroyAll(dropped);
 }
 
-template <class T, class U>
-void AVLTree<T, U>::clear() {
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+void AVLTree<T, U, Alloc, Compare, Stats>::difference(const AVLTree& other, unsigned int threads) {
+    if (&other == this) {
+        this->clear();
+        return;
+    }
+
+    vector<AVLNode<T, U>*> dropped;
+    this->root = this->subtract(this->root, other.root, dropped, threads);
     if (this->root) {
-        this->clear(this->root);
-        this->root = NULL;
+        this->root->parent = NULL;
+    }
+    this->destroyAll(dropped);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+AVLNode<T, U>* AVLTree<T, U, Alloc, Compare, Stats>::bound(const K& key, bool strict) const {
+    AVLProbe<T, K, Compare> probe(key, this->compare);
+    AVLNode<T, U>* node = this->root;
+    AVLNode<T, U>* candidate = NULL;
+    size_t depth = 0;
+    while (node) {
+        depth++;
+        int order = probe.against(node);
+        if (order < 0 || (!strict && order == 0)) {
+            candidate = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    this->stats.lookup(depth);
+    return candidate;
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::begin() {
+    AVLNode<T, U>* node = this->root;
+    while (node && node->left) {
+        node = node->left;
     }
+    return iterator(node, &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::begin() const {
+    return const_cast<AVLTree<T, U, Alloc, Compare, Stats>*>(this)->begin();
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::end() {
+    return iterator(NULL, &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::end() const {
+    return const_iterator(NULL, &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::lower_bound(const K& key) {
+    return iterator(this->bound(key, false), &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::lower_bound(const K& key) const {
+    return const_iterator(this->bound(key, false), &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::iterator AVLTree<T, U, Alloc, Compare, Stats>::upper_bound(const K& key) {
+    return iterator(this->bound(key, true), &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator AVLTree<T, U, Alloc, Compare, Stats>::upper_bound(const K& key) const {
+    return const_iterator(this->bound(key, true), &this->root);
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+pair<typename AVLTree<T, U, Alloc, Compare, Stats>::iterator, typename AVLTree<T, U, Alloc, Compare, Stats>::iterator>
+AVLTree<T, U, Alloc, Compare, Stats>::equal_range(const K& key) {
+    return make_pair(this->lower_bound(key), this->upper_bound(key));
+}
+
+template <class T, class U, template <class> class Alloc, class Compare, class Stats>
+template <class K>
+pair<typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator, typename AVLTree<T, U, Alloc, Compare, Stats>::const_iterator>
+AVLTree<T, U, Alloc, Compare, Stats>::equal_range(const K& key) const {
+    return make_pair(this->lower_bound(key), this->upper_bound(key));
 }
 
 #endif
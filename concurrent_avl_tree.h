@@ -0,0 +1,463 @@
+#ifndef _CONCURRENT_AVL_TREE_H
+#define _CONCURRENT_AVL_TREE_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A node of the concurrent AVL tree.  Once a node is reachable from a
+ * published root it is never modified again; writers replace it with
+ * a copy instead.  That is what lets readers walk the tree without
+ * taking any lock.
+ */
+template <class T, class U>
+class ConcurrentAVLNode {
+public:
+    ConcurrentAVLNode* left;
+    ConcurrentAVLNode* right;
+    T key;
+    U data;
+    unsigned int height;
+
+    /**
+     * The write operation that created this node.  A node belonging
+     * to the write in progress has not been published yet and may be
+     * changed in place; any other node must be copied first.
+     */
+    unsigned long version;
+
+    ConcurrentAVLNode(const T&, const U&, unsigned long);
+    ConcurrentAVLNode(const ConcurrentAVLNode&, unsigned long);
+
+    int factor() const;
+    void update();
+    static unsigned int heightOf(const ConcurrentAVLNode*);
+};
+
+/**
+ * A thread-safe AVL tree whose lookups never block.
+ *
+ * Writers never change a published node.  An insert or erase copies
+ * the nodes on its root-to-leaf path, plus the few siblings a rotation
+ * touches, and then publishes the new root with one atomic store.  A
+ * reader loads the root once and sees a consistent, immutable tree for
+ * the rest of its lookup, no matter what writers do meanwhile.  Since
+ * every write produces a new root, writers take turns on a single
+ * mutex.
+ *
+ * Nodes replaced by a write are retired and freed in batches once no
+ * reader can still be looking at them.  Readers announce themselves in
+ * one of two counters of a striped array, selected by a global phase.
+ * To reclaim, the writer that fills a batch takes it over, releases the
+ * write mutex, then flips the phase and waits for the counters of the
+ * previous phase to drain.  A slow reader thus delays the return of
+ * that one write, but never blocks other writers.
+ */
+template <class T, class U>
+class ConcurrentAVLTree {
+private:
+    typedef ConcurrentAVLNode<T, U> Node;
+
+    /**
+     * Reader counters, padded to a cache line each so that readers on
+     * different stripes do not contend.
+     */
+    struct alignas(64) Stripe {
+        atomic<long> readers[2];
+    };
+
+    static const size_t stripes = 64;
+
+    /**
+     * Number of retired nodes that triggers a reclamation.
+     */
+    static const size_t retireBatch = 4096;
+
+    atomic<Node*> root;
+    atomic<size_t> nodeCount;
+    atomic<unsigned long> phase;
+    mutable Stripe readers[stripes];
+
+    /**
+     * Serializes writers and guards everything below.
+     */
+    mutex writeLock;
+    unsigned long version;
+    vector<Node*> retired;
+
+    /**
+     * Serializes reclamations, so that each phase flip waits for the
+     * readers of the one before.
+     */
+    mutex reclaimLock;
+
+    /**
+     * Returns the reader stripe of the calling thread.
+     */
+    static size_t stripe();
+
+    /**
+     * Registers the calling thread as a reader and returns the phase
+     * it registered under, to be passed to leave().
+     */
+    unsigned long enter() const;
+    void leave(unsigned long) const;
+
+    /**
+     * Waits until every reader that might have seen one of the retired
+     * nodes is gone, then frees them.  Called without the write mutex.
+     */
+    void reclaim(vector<Node*>&);
+
+    /**
+     * Returns a version of the node that the current write may
+     * change, copying and retiring it if it is already published.
+     */
+    Node* writable(Node*);
+
+    Node* balance(Node*);
+    Node* singleRotateLeft(Node*);
+    Node* singleRotateRight(Node*);
+    Node* insert(const T&, const U&, Node*);
+    Node* erase(const T&, Node*);
+    Node* eraseMin(Node*, Node*&);
+    void clear(Node*);
+
+    /**
+     * Disallow copying.
+     */
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    /**
+     * Looks up the key without taking any lock.  On a hit the data is
+     * copied into the reference and true is returned.
+     */
+    template <class K>
+    bool find(const K& key, U& data) const;
+
+    /**
+     * Inserts or replaces the data under the given key.
+     */
+    void insert(const T& key, const U& data);
+
+    /**
+     * Deletes the node identified by the key, if any.
+     */
+    void erase(const T& key);
+
+    /**
+     * Returns the number of nodes.
+     */
+    size_t size() const;
+};
+
+
+template <class T, class U>
+ConcurrentAVLNode<T, U>::ConcurrentAVLNode(const T& key, const U& data, unsigned long version) : key(key), data(data) {
+    this->left = NULL;
+    this->right = NULL;
+    this->height = 1;
+    this->version = version;
+}
+
+template <class T, class U>
+ConcurrentAVLNode<T, U>::ConcurrentAVLNode(const ConcurrentAVLNode& other, unsigned long version) : key(other.key), data(other.data) {
+    this->left = other.left;
+    this->right = other.right;
+    this->height = other.height;
+    this->version = version;
+}
+
+template <class T, class U>
+int ConcurrentAVLNode<T, U>::factor() const {
+    return (int) heightOf(this->left) - (int) heightOf(this->right);
+}
+
+template <class T, class U>
+void ConcurrentAVLNode<T, U>::update() {
+    unsigned int leftHeight = heightOf(this->left);
+    unsigned int rightHeight = heightOf(this->right);
+    this->height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+}
+
+template <class T, class U>
+unsigned int ConcurrentAVLNode<T, U>::heightOf(const ConcurrentAVLNode* node) {
+    return node ? node->height : 0;
+}
+
+template <class T, class U>
+ConcurrentAVLTree<T, U>::ConcurrentAVLTree() : root(NULL), nodeCount(0), phase(0) {
+    for (size_t i = 0; i < stripes; i++) {
+        this->readers[i].readers[0].store(0);
+        this->readers[i].readers[1].store(0);
+    }
+    this->version = 0;
+}
+
+template <class T, class U>
+ConcurrentAVLTree<T, U>::~ConcurrentAVLTree() {
+    this->clear(this->root.load());
+    for (size_t i = 0; i < this->retired.size(); i++) {
+        delete this->retired[i];
+    }
+}
+
+template <class T, class U>
+size_t ConcurrentAVLTree<T, U>::stripe() {
+    static atomic<size_t> threads(0);
+    static thread_local size_t index = threads.fetch_add(1) % stripes;
+    return index;
+}
+
+template <class T, class U>
+unsigned long ConcurrentAVLTree<T, U>::enter() const {
+    Stripe& stripe = this->readers[ConcurrentAVLTree::stripe()];
+    for (;;) {
+        unsigned long current = this->phase.load();
+        stripe.readers[current & 1].fetch_add(1);
+        // A writer flipping the phase in between only waits for the
+        // counters of the old phase, so register again under the new
+        // one rather than risk going unnoticed.
+        if (this->phase.load() == current) {
+            return current;
+        }
+        stripe.readers[current & 1].fetch_sub(1);
+    }
+}
+
+template <class T, class U>
+void ConcurrentAVLTree<T, U>::leave(unsigned long current) const {
+    Stripe& stripe = this->readers[ConcurrentAVLTree::stripe()];
+    stripe.readers[current & 1].fetch_sub(1, memory_order_release);
+}
+
+template <class T, class U>
+void ConcurrentAVLTree<T, U>::reclaim(vector<Node*>& batch) {
+    lock_guard<mutex> guard(this->reclaimLock);
+    unsigned long previous = this->phase.fetch_add(1);
+    for (size_t i = 0; i < stripes; i++) {
+        while (this->readers[i].readers[previous & 1].load() != 0) {
+            this_thread::yield();
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        delete batch[i];
+    }
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::writable(Node* node) {
+    if (node->version == this->version) {
+        return node;
+    }
+
+    this->retired.push_back(node);
+    return new Node(*node, this->version);
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::singleRotateLeft(Node* node) {
+    Node* left = this->writable(node->left);
+    node->left = left->right;
+    left->right = node;
+
+    node->update();
+    left->update();
+
+    return left;
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::singleRotateRight(Node* node) {
+    Node* right = this->writable(node->right);
+    node->right = right->left;
+    right->left = node;
+
+    node->update();
+    right->update();
+
+    return right;
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::balance(Node* node) {
+    node->update();
+
+    int factor = node->factor();
+    if (factor == 2) {
+        if (node->left->factor() < 0) {
+            node->left = this->singleRotateRight(this->writable(node->left));
+        }
+        node = this->singleRotateLeft(node);
+    } else if (factor == -2) {
+        if (node->right->factor() > 0) {
+            node->right = this->singleRotateLeft(this->writable(node->right));
+        }
+        node = this->singleRotateRight(node);
+    }
+
+    return node;
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::insert(const T& key, const U& data, Node* node) {
+    if (!node) {
+        this->nodeCount.fetch_add(1, memory_order_relaxed);
+        return new Node(key, data, this->version);
+    }
+
+    if (key < node->key) {
+        Node* left = this->insert(key, data, node->left);
+        node = this->writable(node);
+        node->left = left;
+    } else if (node->key < key) {
+        Node* right = this->insert(key, data, node->right);
+        node = this->writable(node);
+        node->right = right;
+    } else {
+        node = this->writable(node);
+        node->data = data;
+        return node;
+    }
+
+    return this->balance(node);
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::eraseMin(Node* node, Node*& min) {
+    if (!node->left) {
+        min = node;
+        return node->right;
+    }
+
+    Node* left = this->eraseMin(node->left, min);
+    node = this->writable(node);
+    node->left = left;
+    return this->balance(node);
+}
+
+template <class T, class U>
+typename ConcurrentAVLTree<T, U>::Node* ConcurrentAVLTree<T, U>::erase(const T& key, Node* node) {
+    if (!node) {
+        return NULL;
+    }
+
+    if (key < node->key) {
+        Node* left = this->erase(key, node->left);
+        if (left == node->left) {
+            return node;
+        }
+        node = this->writable(node);
+        node->left = left;
+    } else if (node->key < key) {
+        Node* right = this->erase(key, node->right);
+        if (right == node->right) {
+            return node;
+        }
+        node = this->writable(node);
+        node->right = right;
+    } else {
+        Node* left = node->left;
+        Node* right = node->right;
+        this->retired.push_back(node);
+        this->nodeCount.fetch_sub(1, memory_order_relaxed);
+
+        if (!right) {
+            return left;
+        }
+
+        Node* successor = NULL;
+        right = this->eraseMin(right, successor);
+        node = this->writable(successor);
+        node->left = left;
+        node->right = right;
+    }
+
+    return this->balance(node);
+}
+
+template <class T, class U>
+void ConcurrentAVLTree<T, U>::clear(Node* node) {
+    if (!node) {
+        return;
+    }
+
+    this->clear(node->left);
+    this->clear(node->right);
+    delete node;
+}
+
+template <class T, class U>
+template <class K>
+bool ConcurrentAVLTree<T, U>::find(const K& key, U& data) const {
+    unsigned long current = this->enter();
+    bool found = false;
+
+    const Node* node = this->root.load(memory_order_acquire);
+    while (node) {
+        if (key < node->key) {
+            node = node->left;
+        } else if (node->key < key) {
+            node = node->right;
+        } else {
+            data = node->data;
+            found = true;
+            break;
+        }
+    }
+
+    this->leave(current);
+    return found;
+}
+
+template <class T, class U>
+void ConcurrentAVLTree<T, U>::insert(const T& key, const U& data) {
+    vector<Node*> batch;
+    {
+        lock_guard<mutex> guard(this->writeLock);
+        this->version++;
+        this->root.store(this->insert(key, data, this->root.load(memory_order_relaxed)));
+        if (this->retired.size() >= retireBatch) {
+            batch.swap(this->retired);
+        }
+    }
+    if (!batch.empty()) {
+        this->reclaim(batch);
+    }
+}
+
+template <class T, class U>
+void ConcurrentAVLTree<T, U>::erase(const T& key) {
+    vector<Node*> batch;
+    {
+        lock_guard<mutex> guard(this->writeLock);
+        this->version++;
+        Node* root = this->root.load(memory_order_relaxed);
+        Node* replacement = this->erase(key, root);
+        if (replacement != root) {
+            this->root.store(replacement);
+        }
+        if (this->retired.size() >= retireBatch) {
+            batch.swap(this->retired);
+        }
+    }
+    if (!batch.empty()) {
+        this->reclaim(batch);
+    }
+}
+
+template <class T, class U>
+size_t ConcurrentAVLTree<T, U>::size() const {
+    return this->nodeCount.load(memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef _PERSISTENT_AVL_TREE_H
+#define _PERSISTENT_AVL_TREE_H
+
+#include <atomic>
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * A node of the persistent AVL tree.  Nodes are shared between all
+ * versions of the tree that contain them and counted: refs is the
+ * number of parent nodes plus tree handles pointing at the node.
+ */
+template <class T, class U>
+class PersistentAVLNode {
+public:
+    PersistentAVLNode* left;
+    PersistentAVLNode* right;
+    T key;
+    U data;
+    unsigned int height;
+
+    /**
+     * The reference count.  Atomic so that versions sharing nodes can
+     * be copied and dropped on different threads.
+     */
+    atomic<unsigned int> refs;
+
+    PersistentAVLNode(const T&, const U&);
+    PersistentAVLNode(const PersistentAVLNode&);
+
+    int factor() const;
+    void update();
+    static unsigned int heightOf(const PersistentAVLNode*);
+};
+
+/**
+ * A persistent (copy-on-write) AVL tree.  Every PersistentAVLTree
+ * object is a handle to one version of the tree.  Copying a handle, or
+ * calling snapshot(), takes O(1): it only bumps the reference count of
+ * the root.  The copy is a stable view that later changes to the
+ * original never show up in.
+ *
+ * insert() and erase() copy the nodes on the root-to-leaf path that
+ * are shared with another version, O(log n) of them, and change the
+ * rest in place.  A node that only this version can reach is never
+ * copied.  The memory held on top of a single tree therefore grows
+ * with the number of changes made while snapshots are alive, not with
+ * the size of the tree, and a node is freed as soon as the last
+ * version containing it goes away.
+ *
+ * Different handles may be used from different threads at the same
+ * time; a single handle is not thread-safe.
+ */
+template <class T, class U>
+class PersistentAVLTree {
+private:
+    typedef PersistentAVLNode<T, U> Node;
+
+    Node* root;
+    size_t nodeCount;
+
+    static void retain(Node*);
+    static void release(Node*);
+
+    /**
+     * Returns a version of the node that this tree may change in
+     * place.  A node that is shared with another version is replaced
+     * by a private copy, which takes over this tree's reference.
+     */
+    static Node* writable(Node*);
+
+    static Node* balance(Node*);
+    static Node* singleRotateLeft(Node*);
+    static Node* singleRotateRight(Node*);
+    static Node* eraseMin(Node*, Node*&);
+    Node* insert(const T&, const U&, Node*);
+    Node* erase(const T&, Node*);
+
+    template <class K>
+    const Node* findNode(const K&) const;
+public:
+    PersistentAVLTree();
+
+    /**
+     * Takes an O(1) snapshot of the other version.
+     */
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+
+    /**
+     * Drops this version; nodes no other version uses are freed.
+     */
+    ~PersistentAVLTree();
+
+    /**
+     * Returns an O(1) snapshot of this version.
+     */
+    PersistentAVLTree snapshot() const;
+
+    /**
+     * Returns a pointer to the data stored under the key, or NULL.
+     * The pointer stays valid until this version is changed or
+     * destroyed.
+     */
+    template <class K>
+    const U* find(const K& key) const;
+
+    /**
+     * Inserts or replaces the data under the given key in this
+     * version only.
+     */
+    void insert(const T& key, const U& data);
+
+    /**
+     * Deletes the node identified by the key from this version only.
+     */
+    void erase(const T& key);
+
+    /**
+     * Returns the number of nodes in this version.
+     */
+    size_t size() const;
+};
+
+
+template <class T, class U>
+PersistentAVLNode<T, U>::PersistentAVLNode(const T& key, const U& data) : key(key), data(data), refs(1) {
+    this->left = NULL;
+    this->right = NULL;
+    this->height = 1;
+}
+
+template <class T, class U>
+PersistentAVLNode<T, U>::PersistentAVLNode(const PersistentAVLNode& other) : key(other.key), data(other.data), refs(1) {
+    this->left = other.left;
+    this->right = other.right;
+    this->height = other.height;
+}
+
+template <class T, class U>
+int PersistentAVLNode<T, U>::factor() const {
+    return (int) heightOf(this->left) - (int) heightOf(this->right);
+}
+
+template <class T, class U>
+void PersistentAVLNode<T, U>::update() {
+    unsigned int leftHeight = heightOf(this->left);
+    unsigned int rightHeight = heightOf(this->right);
+    this->height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+}
+
+template <class T, class U>
+unsigned int PersistentAVLNode<T, U>::heightOf(const PersistentAVLNode* node) {
+    return node ? node->height : 0;
+}
+
+template <class T, class U>
+PersistentAVLTree<T, U>::PersistentAVLTree() {
+    this->root = NULL;
+    this->nodeCount = 0;
+}
+
+template <class T, class U>
+PersistentAVLTree<T, U>::PersistentAVLTree(const PersistentAVLTree& other) {
+    this->root = other.root;
+    this->nodeCount = other.nodeCount;
+    retain(this->root);
+}
+
+template <class T, class U>
+PersistentAVLTree<T, U>& PersistentAVLTree<T, U>::operator=(const PersistentAVLTree& other) {
+    retain(other.root);
+    release(this->root);
+    this->root = other.root;
+    this->nodeCount = other.nodeCount;
+    return *this;
+}
+
+template <class T, class U>
+PersistentAVLTree<T, U>::~PersistentAVLTree() {
+    release(this->root);
+}
+
+template <class T, class U>
+void PersistentAVLTree<T, U>::retain(Node* node) {
+    if (node) {
+        node->refs.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+template <class T, class U>
+void PersistentAVLTree<T, U>::release(Node* node) {
+    while (node && node->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+        Node* right = node->right;
+        release(node->left);
+        delete node;
+        node = right;
+    }
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::writable(Node* node) {
+    if (node->refs.load(memory_order_acquire) == 1) {
+        return node;
+    }
+
+    Node* copy = new Node(*node);
+    retain(copy->left);
+    retain(copy->right);
+    release(node);
+    return copy;
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::singleRotateLeft(Node* node) {
+    Node* left = writable(node->left);
+    node->left = left->right;
+    left->right = node;
+
+    node->update();
+    left->update();
+
+    return left;
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::singleRotateRight(Node* node) {
+    Node* right = writable(node->right);
+    node->right = right->left;
+    right->left = node;
+
+    node->update();
+    right->update();
+
+    return right;
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::balance(Node* node) {
+    node->update();
+
+    int factor = node->factor();
+    if (factor == 2) {
+        if (node->left->factor() < 0) {
+            node->left = writable(node->left);
+            node->left = singleRotateRight(node->left);
+        }
+        node = singleRotateLeft(node);
+    } else if (factor == -2) {
+        if (node->right->factor() > 0) {
+            node->right = writable(node->right);
+            node->right = singleRotateLeft(node->right);
+        }
+        node = singleRotateRight(node);
+    }
+
+    return node;
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::insert(const T& key, const U& data, Node* node) {
+    if (!node) {
+        this->nodeCount++;
+        return new Node(key, data);
+    }
+
+    // Copy on the way down so that the children are referenced by a
+    // node of this version before they are changed in turn.
+    node = writable(node);
+    if (key < node->key) {
+        node->left = this->insert(key, data, node->left);
+    } else if (node->key < key) {
+        node->right = this->insert(key, data, node->right);
+    } else {
+        node->data = data;
+        return node;
+    }
+
+    return balance(node);
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::eraseMin(Node* node, Node*& min) {
+    node = writable(node);
+    if (!node->left) {
+        Node* right = node->right;
+        node->right = NULL;
+        min = node;
+        return right;
+    }
+
+    node->left = eraseMin(node->left, min);
+    return balance(node);
+}
+
+template <class T, class U>
+typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::erase(const T& key, Node* node) {
+    if (key < node->key) {
+        node = writable(node);
+        node->left = this->erase(key, node->left);
+    } else if (node->key < key) {
+        node = writable(node);
+        node->right = this->erase(key, node->right);
+    } else {
+        Node* left = node->left;
+        Node* right = node->right;
+        retain(left);
+        retain(right);
+        release(node);
+        this->nodeCount--;
+
+        if (!right) {
+            return left;
+        }
+
+        Node* successor = NULL;
+        right = eraseMin(right, successor);
+        successor->left = left;
+        successor->right = right;
+        node = successor;
+    }
+
+    return balance(node);
+}
+
+template <class T, class U>
+template <class K>
+const typename PersistentAVLTree<T, U>::Node* PersistentAVLTree<T, U>::findNode(const K& key) const {
+    const Node* node = this->root;
+    while (node) {
+        if (key < node->key) {
+            node = node->left;
+        } else if (node->key < key) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+template <class T, class U>
+PersistentAVLTree<T, U> PersistentAVLTree<T, U>::snapshot() const {
+    return *this;
+}
+
+template <class T, class U>
+template <class K>
+const U* PersistentAVLTree<T, U>::find(const K& key) const {
+    const Node* node = this->findNode(key);
+    return node ? &node->data : NULL;
+}
+
+template <class T, class U>
+void PersistentAVLTree<T, U>::insert(const T& key, const U& data) {
+    this->root = this->insert(key, data, this->root);
+}
+
+template <class T, class U>
+void PersistentAVLTree<T, U>::erase(const T& key) {
+    // Erasing walks down copying shared nodes, so make sure there is
+    // something to erase before paying for that.
+    if (this->findNode(key)) {
+        this->root = this->erase(key, this->root);
+    }
+}
+
+template <class T, class U>
+size_t PersistentAVLTree<T, U>::size() const {
+    return this->nodeCount;
+}
+
+#endif